@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "bit_mask.hpp"
+#include "color_lut.hpp"
+#include "color_mask.hpp"
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// Chroma bins of the adaptive model: 32 x 32 over (cb, cr), 8 levels wide
+const int ADAPTIVE_BIN_SHIFT = 3;
+const int ADAPTIVE_BINS = 256 >> ADAPTIVE_BIN_SHIFT;
+
+// Color model that follows the target as the light changes. It keeps a histogram of the
+// target's chroma, fed with the pixels of the tracked blob and decaying by rate every
+// frame, and a color is target when its bin holds at least share of the weight (it turns
+// off again under half of that). Pixels are binned by the chroma of their table cell, so
+// what is learned is exactly what gets classified, and spread over the neighboring bins
+// too: a uniformly colored target crosses into the next bin all at once as the light
+// drifts, which must already be on by then. The blob is also grown by a pixel before
+// learning, or the model could only ever shrink to the colors it already matches. The
+// lookup table follows incrementally: every bin knows the table cells that fall in it,
+// and only the cells of bins that changed are rewritten. Bins farther than reach from
+// the seed chroma never turn on, so the model cannot wander off to the background
+class AdaptiveColorModel {
+public:
+	AdaptiveColorModel(const ChromaTarget &seed, float rate = 0.05f, int reach = -1, float share = 0.005f, int bits = 5)
+		: _lut(bits), _seed(seed), _rate(rate), _share(share), _min_pixels(64),
+		_weights(ADAPTIVE_BINS * ADAPTIVE_BINS, 0.0f), _counts(ADAPTIVE_BINS * ADAPTIVE_BINS, 0),
+		_on(ADAPTIVE_BINS * ADAPTIVE_BINS, false), _reachable(ADAPTIVE_BINS * ADAPTIVE_BINS, false),
+		_first(ADAPTIVE_BINS * ADAPTIVE_BINS + 1, 0), _bin_of(_lut.cells()), _updates(0), _rewritten(0)
+	{
+		if (reach < 0)
+			reach = 2 * seed.distance;
+		int bins = ADAPTIVE_BINS * ADAPTIVE_BINS, seeded = 0;
+		for (int i = 0; i < bins; i++) {
+			int cb = ((i % ADAPTIVE_BINS) << ADAPTIVE_BIN_SHIFT) + (1 << ADAPTIVE_BIN_SHIFT) / 2 - seed.cb;
+			int cr = ((i / ADAPTIVE_BINS) << ADAPTIVE_BIN_SHIFT) + (1 << ADAPTIVE_BIN_SHIFT) / 2 - seed.cr;
+			_reachable[i] = cb * cb + cr * cr <= reach * reach;
+			if (cb * cb + cr * cr < seed.distance * seed.distance) {
+				_weights[i] = 1;
+				seeded++;
+			}
+		}
+		for (int i = 0; i < bins && seeded; i++)
+			_weights[i] /= seeded;
+
+		// Table cells grouped by bin, cells outside the luma band in none
+		for (size_t c = 0; c < _lut.cells(); c++) {
+			uint8_t r, g, b;
+			_lut.center(c, r, g, b);
+			_bin_of[c] = (int16_t)bin(r, g, b);
+			if (_bin_of[c] >= 0)
+				_first[_bin_of[c] + 1]++;
+		}
+		for (int i = 0; i < bins; i++)
+			_first[i + 1] += _first[i];
+		_cells.resize(_first[bins]);
+		std::vector<uint32_t> next(_first.begin(), _first.end() - 1);
+		for (size_t c = 0; c < _lut.cells(); c++)
+			if (_bin_of[c] >= 0)
+				_cells[next[_bin_of[c]]++] = (uint32_t)c;
+
+		refresh();
+		_rewritten = 0;
+	}
+
+	// Table of the current model, changed in place by learn()
+	const ColorLut &lut() const { return _lut; }
+
+	// Feeds the model with the set pixels of mask inside window and their neighbors,
+	// normally the tracked blob, kept alone in the scanner's mask. Masks of fewer pixels
+	// than the minimum are ignored, they are too small to tell the target's color from noise
+	void learn(const FrameView &frame, const BitMask &mask, const Window &window)
+	{
+		int total = 0, W = mask.width(), H = mask.height(), last = mask.stride() - 1;
+		uint64_t tail = W % 64 ? ((uint64_t)1 << (W % 64)) - 1 : ~(uint64_t)0;
+		int top = window.top > 0 ? window.top - 1 : 0, bottom = window.bottom < H - 1 ? window.bottom + 1 : H - 1;
+		for (int y = top; y <= bottom; y++) {
+			const uint64_t *bits = mask.row(y);
+			const uint64_t *above = y > 0 ? mask.row(y - 1) : NULL, *below = y < H - 1 ? mask.row(y + 1) : NULL;
+			const uint8_t *rgb = frame.color + (size_t)3 * y * W;
+			for (int w = window.left / 64; w <= window.right / 64; w++) {
+				uint64_t grown = bits[w] | bits[w] << 1 | bits[w] >> 1 | (w > 0 ? bits[w - 1] >> 63 : 0) |
+					(w < last ? bits[w + 1] << 63 : 0) | (above ? above[w] : 0) | (below ? below[w] : 0);
+				if (w == last)
+					grown &= tail;
+				for (uint64_t word = grown; word; word &= word - 1) {
+					const uint8_t *p = rgb + 3 * (64 * w + lowest_bit(word));
+					int i = _bin_of[_lut.cell(p[0], p[1], p[2])];
+					if (i >= 0) {
+						_counts[i]++;
+						total++;
+					}
+				}
+			}
+		}
+		if (total >= _min_pixels) {
+			// Each bin gets 1/4 of its own pixels, 1/8 of those of the 4 bins next to it
+			// and 1/16 of the diagonal ones
+			for (int i = 0; i < ADAPTIVE_BINS * ADAPTIVE_BINS; i++) {
+				int cb = i % ADAPTIVE_BINS, cr = i / ADAPTIVE_BINS, sum = 0;
+				for (int dr = -1; dr <= 1; dr++) {
+					for (int db = -1; db <= 1; db++) {
+						if (cb + db >= 0 && cb + db < ADAPTIVE_BINS && cr + dr >= 0 && cr + dr < ADAPTIVE_BINS)
+							sum += _counts[i + dr * ADAPTIVE_BINS + db] << (2 - (dr != 0) - (db != 0));
+					}
+				}
+				_weights[i] = (1 - _rate) * _weights[i] + _rate * sum / (16.0f * total);
+			}
+			refresh();
+			_updates++;
+		}
+		for (size_t i = 0; i < _counts.size(); i++)
+			_counts[i] = 0;
+	}
+
+	// Frames the model learned from, and table cells rewritten since it was built
+	unsigned long long updates() const { return _updates; }
+	unsigned long long rewritten() const { return _rewritten; }
+
+private:
+	// Chroma bin of a color, -1 outside the luma band
+	int bin(uint8_t r, uint8_t g, uint8_t b) const
+	{
+		int y, cb, cr;
+		rgb_to_ycbcr(r, g, b, y, cb, cr);
+		if (y < _seed.min_luma || y > _seed.max_luma)
+			return -1;
+		return (cr >> ADAPTIVE_BIN_SHIFT) * ADAPTIVE_BINS + (cb >> ADAPTIVE_BIN_SHIFT);
+	}
+
+	// Turns bins on and off with hysteresis, and relabels the cells of those that changed
+	void refresh()
+	{
+		for (size_t i = 0; i < _weights.size(); i++) {
+			bool on = _reachable[i] && (_on[i] ? _weights[i] >= _share / 2 : _weights[i] >= _share);
+			if (on == _on[i])
+				continue;
+			_on[i] = on;
+			for (uint32_t c = _first[i]; c < _first[i + 1]; c++)
+				_lut.set(_cells[c], on ? 1 : 0);
+			_rewritten += _first[i + 1] - _first[i];
+		}
+	}
+
+	ColorLut _lut;
+	ChromaTarget _seed;
+	float _rate, _share;
+	int _min_pixels;
+	std::vector<float> _weights;
+	std::vector<int> _counts;
+	std::vector<bool> _on, _reachable;
+	std::vector<uint32_t> _first;  // cells of bin i are _cells[_first[i]] to _cells[_first[i + 1] - 1]
+	std::vector<uint32_t> _cells;
+	std::vector<int16_t> _bin_of;  // bin of every table cell, -1 for none
+	unsigned long long _updates, _rewritten;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <bitset>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a non-zero word
+inline int lowest_bit(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+// One bit per pixel, rows padded to whole 64-bit words: a 640x480 mask is 38400 bytes
+// where the 3-byte RGB one was 921600, and a word tests or clears 64 pixels at once
+class BitMask {
+public:
+	BitMask() : _width(0), _height(0), _stride(0) {}
+	BitMask(int width, int height) : _width(0), _height(0), _stride(0) { resize(width, height); }
+
+	// Only reallocates when the size changes, the bits are left as they were otherwise
+	void resize(int width, int height)
+	{
+		if (width == _width && height == _height)
+			return;
+		_width = width;
+		_height = height;
+		_stride = (width + 63) / 64;
+		_words.assign((size_t)_stride * height, 0);
+	}
+
+	int width() const { return _width; }
+	int height() const { return _height; }
+	// Words per row
+	int stride() const { return _stride; }
+
+	uint64_t *row(int y) { return &_words[(size_t)y * _stride]; }
+	const uint64_t *row(int y) const { return &_words[(size_t)y * _stride]; }
+
+	bool get(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+	void set(int x, int y) { row(y)[x >> 6] |= (uint64_t)1 << (x & 63); }
+	void reset(int x, int y) { row(y)[x >> 6] &= ~((uint64_t)1 << (x & 63)); }
+
+	void swap(BitMask &other)
+	{
+		std::swap(_width, other._width);
+		std::swap(_height, other._height);
+		std::swap(_stride, other._stride);
+		_words.swap(other._words);
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < _words.size(); i++)
+			_words[i] = 0;
+	}
+
+	// Set pixels
+	size_t count() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < _words.size(); i++)
+			total += std::bitset<64>(_words[i]).count();
+		return total;
+	}
+
+private:
+	int _width, _height, _stride;
+	std::vector<uint64_t> _words;
+};
+
+// Paints the set pixels of the mask (red, green, blue) and the others black, into
+// width * height * 3 bytes. Only meant for display
+inline void expand_mask(const BitMask &mask, uint8_t red, uint8_t green, uint8_t blue, uint8_t *rgb)
+{
+	for (int y = 0; y < mask.height(); y++) {
+		const uint64_t *bits = mask.row(y);
+		uint8_t *out = rgb + (size_t)3 * y * mask.width();
+		for (int x = 0; x < mask.width(); x++) {
+			bool set = (bits[x >> 6] >> (x & 63)) & 1;
+			out[3 * x] = set ? red : 0;
+			out[3 * x + 1] = set ? green : 0;
+			out[3 * x + 2] = set ? blue : 0;
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <float.h>
+#include <limits.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// What blobs are ranked by
+enum BlobKey {
+	BLOB_AREA,          // pixels
+	BLOB_METRIC_AREA,   // square meters facing the camera
+	BLOB_DEPTH,         // mean depth, in meters
+	BLOB_COMPACTNESS    // 1 for a filled disc, less the longer, hollower or more ragged
+};
+
+// Which blobs of a scan to return: the k best by key, largest first unless ascending,
+// among those within every filter. Filters are inclusive and open by default. Blobs
+// without depth data have no depth nor metric area, and are left out whenever the key or
+// a filter needs those
+struct BlobQuery {
+	BlobQuery(BlobKey key = BLOB_AREA, int k = 1) : key(key), k(k), ascending(false),
+		min_area(0), max_area(INT_MAX), min_metric_area(0), max_metric_area(FLT_MAX),
+		min_depth(0), max_depth(FLT_MAX), min_compactness(0), max_compactness(FLT_MAX) {}
+
+	BlobKey key;
+	int k;
+	bool ascending;                           // smallest first, as for the nearest blobs
+	int min_area, max_area;
+	float min_metric_area, max_metric_area;
+	float min_depth, max_depth;
+	float min_compactness, max_compactness;
+};
+
+// A blob picked by a query, with the value it was ranked by
+struct RankedBlob {
+	const BlobStats *blob;
+	double key;
+};
+
+// Orders ranked blobs best first, ties by their first pixel
+struct BetterBlob {
+	BetterBlob(bool ascending) : ascending(ascending) {}
+	bool operator()(const RankedBlob &a, const RankedBlob &b) const
+	{
+		if (a.key != b.key)
+			return ascending ? a.key < b.key : a.key > b.key;
+		return a.blob->first < b.blob->first;
+	}
+	bool ascending;
+};
+
+inline double blob_depth(const BlobStats &blob)
+{
+	return blob.count ? blob.z / blob.count : 0;
+}
+
+// Every pixel at depth z covers z / fx by z / fy meters. Taken at the mean depth, so a
+// blob slanted away from the camera comes out slightly smaller than it is
+inline double blob_metric_area(const BlobStats &blob, const Intrinsics &intrin)
+{
+	double z = blob_depth(blob);
+	return blob.size * z * z / ((double)intrin.fx * intrin.fy);
+}
+
+// Area over that of the disc with the same second moments, a disc of radius r having a
+// variance of r^2 / 4 along each axis. Pixels are counted as unit squares, adding 1 / 12
+// to each variance, so that the smallest blobs stay near 1 as well
+inline double blob_compactness(const BlobStats &blob)
+{
+	double n = blob.size, mx = blob.px / n, my = blob.py / n;
+	double spread = blob.pxx / n - mx * mx + blob.pyy / n - my * my + 1.0 / 6;
+	return n / (2 * 3.14159265358979 * spread);
+}
+
+inline double blob_key(const BlobStats &blob, BlobKey key, const Intrinsics &intrin)
+{
+	switch (key) {
+	case BLOB_METRIC_AREA:
+		return blob_metric_area(blob, intrin);
+	case BLOB_DEPTH:
+		return blob_depth(blob);
+	case BLOB_COMPACTNESS:
+		return blob_compactness(blob);
+	default:
+		return blob.size;
+	}
+}
+
+// Fills ranked with the blobs query asks for, best first. Ties go to the first blob in
+// raster order, so a query for the largest blob picks the one largest_blob does. Only the
+// sums of every blob are looked at, and the k best are selected before being sorted, so
+// the cost follows the number of blobs whatever k is. ranked is reused from call to call
+inline void query_blobs(const std::vector<BlobStats> &blobs, const Intrinsics &intrin, const BlobQuery &query,
+	std::vector<RankedBlob> &ranked)
+{
+	bool needs_depth = query.key == BLOB_METRIC_AREA || query.key == BLOB_DEPTH || query.min_depth > 0 ||
+		query.max_depth < FLT_MAX || query.min_metric_area > 0 || query.max_metric_area < FLT_MAX;
+	bool needs_compactness = query.min_compactness > 0 || query.max_compactness < FLT_MAX;
+
+	ranked.clear();
+	for (size_t i = 0; i < blobs.size(); i++) {
+		const BlobStats &blob = blobs[i];
+		if (blob.size < query.min_area || blob.size > query.max_area)
+			continue;
+		if (needs_depth) {
+			if (!blob.count)
+				continue;
+			double depth = blob_depth(blob), area = blob_metric_area(blob, intrin);
+			if (depth < query.min_depth || depth > query.max_depth || area < query.min_metric_area ||
+				area > query.max_metric_area)
+				continue;
+		}
+		if (needs_compactness) {
+			double compactness = blob_compactness(blob);
+			if (compactness < query.min_compactness || compactness > query.max_compactness)
+				continue;
+		}
+		RankedBlob r = { &blob, blob_key(blob, query.key, intrin) };
+		ranked.push_back(r);
+	}
+
+	size_t k = query.k > 0 ? (size_t)query.k : 0;
+	BetterBlob better(query.ascending);
+	if (ranked.size() > k) {
+		if (k > 0)
+			std::nth_element(ranked.begin(), ranked.begin() + (k - 1), ranked.end(), better);
+		ranked.resize(k);
+	}
+	std::sort(ranked.begin(), ranked.end(), better);
+}
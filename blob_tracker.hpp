@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "localize.hpp"
+
+// Localizes the largest blob frame after frame, only searching where it is expected: its
+// last bounding box, moved by its velocity and grown by padding. Once the target is found
+// the cost follows its size rather than the sensor's resolution. The whole frame is
+// scanned when nothing is tracked, when the window holds no blob, or when the blob
+// touches the window's edge and may extend past it. Blobs outside the window are not
+// seen, so result.blobs only counts those inside
+class BlobTracker {
+public:
+	BlobTracker(int padding = 32)
+		: _padding(padding), _tracking(false), _dx(0), _dy(0), _full_scans(0), _window_scans(0)
+	{
+		Window none = { 0, 0, -1, -1 };
+		_box = none;
+	}
+
+	// Returns the blob, NULL when there is none
+	const BlobStats *localize(const FrameView &frame, BlobScanner &scanner, const Point3 *vertices, Localization &result,
+		const Segmentation *segmentation = NULL)
+	{
+		if (_tracking) {
+			Window window = predict();
+			scanner.scan(frame, vertices, segmentation, &window);
+			_window_scans++;
+			const BlobStats *blob = localize_largest(scanner, result);
+			if (blob && !blob_touches(*blob, scanner.scanned(), frame)) {
+				follow(*blob);
+				return blob;
+			}
+			_tracking = false;
+		}
+		scanner.scan(frame, vertices, segmentation);
+		_full_scans++;
+		const BlobStats *blob = localize_largest(scanner, result);
+		if (blob)
+			follow(*blob);
+		return blob;
+	}
+
+	bool tracking() const { return _tracking; }
+	unsigned long long full_scans() const { return _full_scans; }
+	unsigned long long window_scans() const { return _window_scans; }
+
+private:
+	Window predict() const
+	{
+		int pad_x = _padding + abs(_dx), pad_y = _padding + abs(_dy);
+		Window window = { _box.left + _dx - pad_x, _box.top + _dy - pad_y, _box.right + _dx + pad_x, _box.bottom + _dy + pad_y };
+		return window;
+	}
+
+	// Velocity is the motion of the bounding box center since the last frame, none when
+	// the blob was just found
+	void follow(const BlobStats &blob)
+	{
+		Window box = { blob.left, blob.top, blob.right, blob.bottom };
+		_dx = _tracking ? (box.left + box.right - _box.left - _box.right) / 2 : 0;
+		_dy = _tracking ? (box.top + box.bottom - _box.top - _box.bottom) / 2 : 0;
+		_box = box;
+		_tracking = true;
+	}
+
+	int _padding;
+	bool _tracking;
+	Window _box;
+	int _dx, _dy;
+	unsigned long long _full_scans, _window_scans;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// What push() does when the queue is full
+enum QueuePolicy {
+	QUEUE_DROP_OLDEST, // evict the oldest item, latency stays bounded
+	QUEUE_BLOCK        // wait for the consumer, nothing is lost
+};
+
+// Thread-safe FIFO holding at most capacity items
+template <class T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity, QueuePolicy policy = QUEUE_DROP_OLDEST)
+		: _capacity(capacity ? capacity : 1), _policy(policy), _closed(false), _dropped(0) {}
+
+	// Returns false once the queue is closed
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_policy == QUEUE_BLOCK)
+			_not_full.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+		if (_closed)
+			return false;
+		while (_items.size() >= _capacity) {
+			_items.pop_front();
+			_dropped++;
+		}
+		_items.push_back(std::move(item));
+		_not_empty.notify_one();
+		return true;
+	}
+
+	bool try_pop(T &item)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_items.empty())
+			return false;
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	// Waits for an item, returns false once the queue is closed and drained
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+		if (_items.empty())
+			return false;
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	// Pops the oldest item only if ready(item) holds, checked under the same lock so a
+	// push cannot evict it in between
+	template <class Ready>
+	bool try_pop_if(T &item, Ready ready)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_items.empty() || !ready(_items.front()))
+			return false;
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	// Wakes every waiting producer and consumer, later pushes fail
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_not_full.notify_all();
+		_not_empty.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _items.size();
+	}
+
+	// Items evicted by QUEUE_DROP_OLDEST or discarded by the consumer
+	unsigned long long dropped() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _dropped;
+	}
+
+	void count_dropped()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_dropped++;
+	}
+
+private:
+	BoundedQueue(const BoundedQueue &);
+	BoundedQueue &operator=(const BoundedQueue &);
+
+	size_t _capacity;
+	QueuePolicy _policy;
+	bool _closed;
+	unsigned long long _dropped;
+	std::deque<T> _items;
+	mutable std::mutex _mutex;
+	std::condition_variable _not_full, _not_empty;
+};
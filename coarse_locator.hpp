@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "frame_arena.hpp"
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// Localizes the largest blob coarse to fine. The frame is first sampled down by factor
+// (4 or 8: one pixel out of 16 or 64), and that small frame is masked and labeled in
+// full. Every blob found there is a candidate tile, its bounding box scaled back up and
+// grown by a block on each side, and only those tiles are masked and labeled at full
+// resolution. Candidates go largest first, and tiles with fewer pixels than the best blob
+// found so far are skipped, so noise specks cost little. The answer is the largest blob of
+// the full scan unless a blob fits between the samples, which is never seen; a blob that
+// reaches past its tile falls back to a full scan. result.blobs only counts the blobs of
+// the tile that won
+class CoarseLocator {
+public:
+	CoarseLocator(int factor = 4) : _factor(factor), _tiles(0), _full_scans(0) {}
+
+	int factor() const { return _factor; }
+
+	// Returns the blob, NULL when there is none
+	const BlobStats *localize(const FrameView &frame, BlobScanner &scanner, const Point3 *vertices, Localization &result,
+		const Segmentation *segmentation = NULL)
+	{
+		int f = _factor;
+		_arena.reset();
+		downsample(frame);
+		_coarse_scanner.scan(_coarse, NULL, segmentation);
+
+		const std::vector<BlobStats> &coarse = _coarse_scanner.blobs();
+		int candidates = (int)coarse.size();
+		int *order = _arena.allocate<int>(candidates);
+		for (int i = 0; i < candidates; i++)
+			order[i] = i;
+		std::sort(order, order + candidates, BySize(coarse));
+
+		// Largest blob over the tiles, ties to the first in raster order like a full scan.
+		// The empty tile stands for none
+		int best_size = 0, best_first = 0;
+		Window best_tile = { 0, 0, -1, -1 };
+		bool holds_best = false;
+		for (int i = 0; i < candidates; i++) {
+			const BlobStats &candidate = coarse[order[i]];
+			Window tile = { (candidate.left - 1) * f, (candidate.top - 1) * f,
+				(candidate.right + 2) * f - 1, (candidate.bottom + 2) * f - 1 };
+			tile = clamp(tile, frame);
+			if (area(tile, frame) < best_size)
+				continue;
+			scanner.scan(frame, vertices, segmentation, &tile);
+			_tiles++;
+			holds_best = false;
+			const BlobStats *blob = largest_blob(scanner.blobs());
+			if (!blob)
+				continue;
+			if (blob_touches(*blob, scanner.scanned(), frame)) {
+				scanner.scan(frame, vertices, segmentation);
+				_full_scans++;
+				return localize_largest(scanner, result);
+			}
+			if (blob->size > best_size || (blob->size == best_size && blob->first < best_first)) {
+				best_size = blob->size;
+				best_first = blob->first;
+				best_tile = tile;
+				holds_best = true;
+			}
+		}
+
+		// The scanner holds the last tile, which is not always the best one
+		if (!holds_best)
+			scanner.scan(frame, vertices, segmentation, &best_tile);
+		return localize_largest(scanner, result);
+	}
+
+	// Tiles labeled at full resolution, and frames that needed a full scan
+	unsigned long long tiles() const { return _tiles; }
+	unsigned long long full_scans() const { return _full_scans; }
+	// Heap blocks taken by the per-frame scratch
+	unsigned long long allocations() const { return _arena.allocations(); }
+
+private:
+	struct BySize {
+		BySize(const std::vector<BlobStats> &blobs) : blobs(blobs) {}
+		bool operator()(int a, int b) const { return blobs[a].size > blobs[b].size; }
+		const std::vector<BlobStats> &blobs;
+	};
+
+	static Window clamp(Window window, const FrameView &frame)
+	{
+		if (window.left < 0)
+			window.left = 0;
+		if (window.top < 0)
+			window.top = 0;
+		if (window.right > frame.width - 1)
+			window.right = frame.width - 1;
+		if (window.bottom > frame.height - 1)
+			window.bottom = frame.height - 1;
+		return window;
+	}
+
+	// Pixels the scanner covers for window, which it widens to whole mask words
+	static int area(const Window &window, const FrameView &frame)
+	{
+		int left = window.left & ~63, right = (window.right | 63) < frame.width - 1 ? window.right | 63 : frame.width - 1;
+		return (right - left + 1) * (window.bottom - window.top + 1);
+	}
+
+	// Samples the center pixel of every factor x factor block, color and depth alike so the
+	// coarse frame segments the same way
+	void downsample(const FrameView &frame)
+	{
+		int f = _factor, W = frame.width / f, H = frame.height / f;
+		uint8_t *color = _arena.allocate<uint8_t>((size_t)3 * W * H);
+		uint16_t *coarse_depth = _arena.allocate<uint16_t>((size_t)W * H);
+		for (int y = 0; y < H; y++) {
+			size_t row = (size_t)(y * f + f / 2) * frame.width + f / 2;
+			const uint8_t *rgb = frame.color + 3 * row;
+			const uint16_t *depth = frame.depth + row;
+			uint8_t *to = color + (size_t)3 * y * W;
+			for (int x = 0; x < W; x++) {
+				to[3 * x] = rgb[3 * x * f];
+				to[3 * x + 1] = rgb[3 * x * f + 1];
+				to[3 * x + 2] = rgb[3 * x * f + 2];
+				coarse_depth[(size_t)y * W + x] = depth[x * f];
+			}
+		}
+		_coarse = frame;
+		_coarse.color = color;
+		_coarse.depth = coarse_depth;
+		_coarse.width = W;
+		_coarse.height = H;
+		_coarse.intrin.width = W;
+		_coarse.intrin.height = H;
+		_coarse.intrin.ppx /= f;
+		_coarse.intrin.ppy /= f;
+		_coarse.intrin.fx /= f;
+		_coarse.intrin.fy /= f;
+	}
+
+	int _factor;
+	FrameArena _arena;  // the coarse frame and the candidates, dropped every frame
+	FrameView _coarse;
+	BlobScanner _coarse_scanner;
+	unsigned long long _tiles, _full_scans;
+};
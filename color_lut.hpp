@@ -0,0 +1,198 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Color class of an RGB value, 0 for background
+typedef std::function<uint8_t(uint8_t r, uint8_t g, uint8_t b)> ColorPredicate;
+
+// RGB classifier quantized to bits per channel: 5 bits make a 32 KiB table that stays in
+// L1, 8 bits an exact 16 MiB one. Classifying costs one lookup whatever the color model
+class ColorLut {
+public:
+	ColorLut(int bits = 5) : _bits(checked_bits(bits)), _shift(8 - bits), _table((size_t)1 << (3 * bits), 0) {}
+
+	int bits() const { return _bits; }
+
+	uint8_t classify(uint8_t r, uint8_t g, uint8_t b) const { return _table[cell(r, g, b)]; }
+
+	// Cells are indexed by their quantized red, green and blue, in that order
+	size_t cells() const { return _table.size(); }
+	size_t cell(uint8_t r, uint8_t g, uint8_t b) const
+	{
+		return ((size_t)(r >> _shift) << (2 * _bits)) | ((size_t)(g >> _shift) << _bits) | (b >> _shift);
+	}
+
+	// Color at the center of a cell
+	void center(size_t cell, uint8_t &r, uint8_t &g, uint8_t &b) const
+	{
+		int mask = (1 << _bits) - 1, half = (1 << _shift) >> 1;
+		r = (uint8_t)((((cell >> (2 * _bits)) & mask) << _shift) + half);
+		g = (uint8_t)((((cell >> _bits) & mask) << _shift) + half);
+		b = (uint8_t)(((cell & mask) << _shift) + half);
+	}
+
+	// Relabels a single cell, for models that change a few cells at a time
+	void set(size_t cell, uint8_t label) { _table[cell] = label; }
+
+	// Classifies every cell by the color at its center
+	void build(const ColorPredicate &predicate)
+	{
+		int cells = 1 << _bits, half = (1 << _shift) >> 1;
+		size_t i = 0;
+		for (int r = 0; r < cells; r++)
+			for (int g = 0; g < cells; g++)
+				for (int b = 0; b < cells; b++)
+					_table[i++] = predicate((uint8_t)((r << _shift) + half), (uint8_t)((g << _shift) + half), (uint8_t)((b << _shift) + half));
+	}
+
+	// Marks the cells of count RGB samples, and their neighbors up to radius cells away,
+	// as label
+	void add_samples(const uint8_t *rgb, size_t count, uint8_t label, int radius = 0)
+	{
+		int cells = 1 << _bits;
+		for (size_t i = 0; i < count; i++) {
+			int r = rgb[3 * i] >> _shift, g = rgb[3 * i + 1] >> _shift, b = rgb[3 * i + 2] >> _shift;
+			for (int dr = -radius; dr <= radius; dr++) {
+				if (r + dr < 0 || r + dr >= cells)
+					continue;
+				for (int dg = -radius; dg <= radius; dg++) {
+					if (g + dg < 0 || g + dg >= cells)
+						continue;
+					for (int db = -radius; db <= radius; db++) {
+						if (b + db < 0 || b + db >= cells || dr * dr + dg * dg + db * db > radius * radius)
+							continue;
+						_table[((size_t)(r + dr) << (2 * _bits)) | ((size_t)(g + dg) << _bits) | (b + db)] = label;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	// Shifts by 8 - bits, so anything outside 1 to 8 bits is undefined
+	static int checked_bits(int bits)
+	{
+		if (bits < 1 || bits > 8)
+			throw std::invalid_argument("Color lookup tables take 1 to 8 bits per channel");
+		return bits;
+	}
+
+	int _bits, _shift;
+	std::vector<uint8_t> _table;
+};
+
+// Masks a row of width RGB8 pixels into bits, like the color_mask kernels: set where the
+// table classifies the pixel as anything but background
+inline void color_lut_mask(const uint8_t *rgb, int width, const ColorLut &lut, uint64_t *bits)
+{
+	for (int x = 0; x < width; x += 64) {
+		int n = width - x < 64 ? width - x : 64;
+		uint64_t word = 0;
+		for (int i = 0; i < n; i++) {
+			const uint8_t *p = rgb + 3 * (x + i);
+			word |= (uint64_t)(lut.classify(p[0], p[1], p[2]) != 0) << i;
+		}
+		bits[x / 64] = word;
+	}
+}
+
+// Keeps a lookup table built from the current color model. Changing the model rebuilds
+// the table on a background thread while the previous one stays in use, so current()
+// costs a single atomic load until the new table is ready.
+// current() is meant to be called from one thread.
+class ColorClassifier {
+public:
+	ColorClassifier(const ColorPredicate &predicate, int bits = 5)
+		: _bits(bits), _pending(false), _fresh(false), _stop(false)
+	{
+		std::shared_ptr<ColorLut> lut(new ColorLut(bits));
+		lut->build(predicate);
+		_current = lut;
+		_version = 1;
+		_builder = std::thread([this] { run(); });
+	}
+
+	~ColorClassifier()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_changed.notify_one();
+		_builder.join();
+	}
+
+	// Rebuilds the table for a new color model. Models set while a build runs replace
+	// each other, only the last one is built next
+	void set_predicate(const ColorPredicate &predicate)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_predicate = predicate;
+			_pending = true;
+		}
+		_changed.notify_one();
+	}
+
+	// The newest table. It stays valid for as long as the caller holds on to it
+	const std::shared_ptr<const ColorLut> &current()
+	{
+		if (_fresh.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_current = _built;
+			_built.reset();
+			_fresh.store(false, std::memory_order_relaxed);
+			_version++;
+		}
+		return _current;
+	}
+
+	// Incremented every time current() picks up a rebuilt table
+	unsigned long long version() const { return _version; }
+
+private:
+	ColorClassifier(const ColorClassifier &);
+	ColorClassifier &operator=(const ColorClassifier &);
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;) {
+			_changed.wait(lock, [this] { return _pending || _stop; });
+			if (_stop)
+				return;
+			ColorPredicate predicate = _predicate;
+			_pending = false;
+			lock.unlock();
+
+			std::shared_ptr<ColorLut> lut(new ColorLut(_bits));
+			lut->build(predicate);
+
+			lock.lock();
+			_built = lut;
+			_fresh.store(true, std::memory_order_release);
+		}
+	}
+
+	int _bits;
+	std::shared_ptr<const ColorLut> _current;  // consumer side
+	std::shared_ptr<const ColorLut> _built;    // handed over by the builder
+	unsigned long long _version;
+	ColorPredicate _predicate;
+	bool _pending;
+	std::mutex _mutex;
+	std::condition_variable _changed;
+	std::atomic<bool> _fresh;
+	bool _stop;
+	std::thread _builder;
+};
@@ -0,0 +1,591 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLOR_MASK_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define COLOR_MASK_TARGET(isa)
+#else
+#define COLOR_MASK_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// The kernels mask one row of width RGB8 pixels into (width + 63) / 64 words: bit x % 64
+// of word x / 64 is set where pixel x matches. Bits past the end of the row are cleared
+
+// A color sphere: pixels closer than distance to (red, green, blue) match
+struct ColorTarget {
+	uint8_t red, green, blue;
+	int distance;
+};
+
+enum ColorMaskIsa {
+	COLOR_MASK_SCALAR,
+	COLOR_MASK_SSE41,
+	COLOR_MASK_AVX2,
+	COLOR_MASK_AVX512
+};
+
+typedef void (*ColorMaskKernel)(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits);
+
+inline void color_mask_scalar(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits)
+{
+	int limit = target.distance * target.distance;
+	for (int x = 0; x < width; x += 64) {
+		int n = width - x < 64 ? width - x : 64;
+		uint64_t word = 0;
+		for (int i = 0; i < n; i++) {
+			const uint8_t *p = rgb + 3 * (x + i);
+			int r = p[0] - target.red, g = p[1] - target.green, b = p[2] - target.blue;
+			word |= (uint64_t)(r * r + g * g + b * b < limit) << i;
+		}
+		bits[x / 64] = word;
+	}
+}
+
+// The vector kernels work in 16 bits: channel differences are clamped to distance + 1,
+// which cannot match anyway, so the sum of squares fits for distances up to this
+const int COLOR_MASK_SIMD_DISTANCE = 103;
+
+// A target in YCbCr space (full range BT.601 in 8-bit integer arithmetic): chroma closer
+// than distance to (cb, cr), and luma between min_luma and max_luma. Shading and light
+// level mostly move luma, so the target holds across sites where an RGB sphere does not
+struct ChromaTarget {
+	int cb, cr;
+	int distance;
+	int min_luma, max_luma;
+};
+
+inline void rgb_to_ycbcr(int r, int g, int b, int &y, int &cb, int &cr)
+{
+	y = (77 * r + 150 * g + 29 * b) >> 8;
+	cb = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+	cr = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+}
+
+// Chroma target of an RGB color
+inline ChromaTarget chroma_target(const ColorTarget &color, int distance, int min_luma = 0, int max_luma = 255)
+{
+	ChromaTarget target;
+	int y;
+	rgb_to_ycbcr(color.red, color.green, color.blue, y, target.cb, target.cr);
+	target.distance = distance;
+	target.min_luma = min_luma;
+	target.max_luma = max_luma;
+	return target;
+}
+
+typedef void (*ChromaMaskKernel)(const uint8_t *rgb, int width, const ChromaTarget &target, uint64_t *bits);
+
+inline void chroma_mask_scalar(const uint8_t *rgb, int width, const ChromaTarget &target, uint64_t *bits)
+{
+	int limit = target.distance * target.distance;
+	for (int x = 0; x < width; x += 64) {
+		int n = width - x < 64 ? width - x : 64;
+		uint64_t word = 0;
+		for (int i = 0; i < n; i++) {
+			const uint8_t *p = rgb + 3 * (x + i);
+			int y, cb, cr;
+			rgb_to_ycbcr(p[0], p[1], p[2], y, cb, cr);
+			cb -= target.cb;
+			cr -= target.cr;
+			word |= (uint64_t)(cb * cb + cr * cr < limit && y >= target.min_luma && y <= target.max_luma) << i;
+		}
+		bits[x / 64] = word;
+	}
+}
+
+// Same 16-bit scheme for the two chroma differences
+const int CHROMA_MASK_SIMD_DISTANCE = 126;
+
+// A depth range in Z16 units, both ends included. Pixels without depth read 0, so they
+// only pass when min is 0
+struct DepthBand {
+	uint16_t min, max;
+};
+
+// Depth kernels clear the bits of a mask row whose depth falls outside the band, after a
+// color kernel set them. They run on the row the color kernel just wrote, while it is
+// still in L1, so clutter out of range never reaches the labeler
+typedef void (*DepthBandKernel)(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits);
+
+inline void depth_band_scalar(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits)
+{
+	for (int x = 0; x < width; x += 64) {
+		int n = width - x < 64 ? width - x : 64;
+		uint64_t word = 0;
+		for (int i = 0; i < n; i++)
+			word |= (uint64_t)(depth[x + i] >= band.min && depth[x + i] <= band.max) << i;
+		bits[x / 64] &= word;
+	}
+}
+
+#ifdef COLOR_MASK_X86
+// Byte shuffles gathering each channel of 16 pixels out of their 3 vectors of RGB
+#define COLOR_MASK_GATHER \
+	0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, \
+	1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, \
+	2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, \
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15
+
+alignas(16) static const int8_t color_mask_shuffles[9][16] = { COLOR_MASK_GATHER };
+
+COLOR_MASK_TARGET("sse4.1")
+inline void color_mask_setup16(__m128i shuffle[9])
+{
+	for (int i = 0; i < 9; i++)
+		shuffle[i] = _mm_load_si128((const __m128i *)color_mask_shuffles[i]);
+}
+
+// Splits 16 RGB pixels into one vector per channel
+COLOR_MASK_TARGET("sse4.1")
+inline void color_mask_gather16(const uint8_t *rgb, const __m128i shuffle[9], __m128i &r, __m128i &g, __m128i &b)
+{
+	const __m128i *in = (const __m128i *)rgb;
+	__m128i v0 = _mm_loadu_si128(in), v1 = _mm_loadu_si128(in + 1), v2 = _mm_loadu_si128(in + 2);
+	r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, shuffle[0]), _mm_shuffle_epi8(v1, shuffle[1])), _mm_shuffle_epi8(v2, shuffle[2]));
+	g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, shuffle[3]), _mm_shuffle_epi8(v1, shuffle[4])), _mm_shuffle_epi8(v2, shuffle[5]));
+	b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, shuffle[6]), _mm_shuffle_epi8(v1, shuffle[7])), _mm_shuffle_epi8(v2, shuffle[8]));
+}
+
+// The same for 32 pixels, 16 in each 128-bit lane so the SSE shuffles apply unchanged.
+// The lanes hold pixels 0-15 and 16-31, so the match bytes come out in pixel order
+COLOR_MASK_TARGET("avx2")
+inline void color_mask_setup32(__m256i shuffle[9])
+{
+	for (int i = 0; i < 9; i++)
+		shuffle[i] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)color_mask_shuffles[i]));
+}
+
+COLOR_MASK_TARGET("avx2")
+inline void color_mask_gather32(const uint8_t *rgb, const __m256i shuffle[9], __m256i &r, __m256i &g, __m256i &b)
+{
+	const __m128i *in = (const __m128i *)rgb;
+	__m256i v0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(in)), _mm_loadu_si128(in + 3), 1);
+	__m256i v1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(in + 1)), _mm_loadu_si128(in + 4), 1);
+	__m256i v2 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(in + 2)), _mm_loadu_si128(in + 5), 1);
+	r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, shuffle[0]), _mm256_shuffle_epi8(v1, shuffle[1])), _mm256_shuffle_epi8(v2, shuffle[2]));
+	g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, shuffle[3]), _mm256_shuffle_epi8(v1, shuffle[4])), _mm256_shuffle_epi8(v2, shuffle[5]));
+	b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, shuffle[6]), _mm256_shuffle_epi8(v1, shuffle[7])), _mm256_shuffle_epi8(v2, shuffle[8]));
+}
+
+// 64 pixels at a time, one word of the mask per iteration: 4 x 16 pixels through movemask
+COLOR_MASK_TARGET("sse4.1")
+inline void color_mask_sse41(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits)
+{
+	__m128i shuffle[9];
+	color_mask_setup16(shuffle);
+	__m128i red = _mm_set1_epi8((char)target.red);
+	__m128i green = _mm_set1_epi8((char)target.green);
+	__m128i blue = _mm_set1_epi8((char)target.blue);
+	__m128i limit = _mm_set1_epi8((char)(target.distance + 1));
+	__m128i threshold = _mm_set1_epi16((short)(target.distance * target.distance));
+	__m128i zero = _mm_setzero_si128();
+
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i r, g, bl;
+			color_mask_gather16(rgb + 3 * (x + 16 * k), shuffle, r, g, bl);
+
+			__m128i dr = _mm_min_epu8(_mm_or_si128(_mm_subs_epu8(r, red), _mm_subs_epu8(red, r)), limit);
+			__m128i dg = _mm_min_epu8(_mm_or_si128(_mm_subs_epu8(g, green), _mm_subs_epu8(green, g)), limit);
+			__m128i db = _mm_min_epu8(_mm_or_si128(_mm_subs_epu8(bl, blue), _mm_subs_epu8(blue, bl)), limit);
+
+			__m128i lo = _mm_unpacklo_epi8(dr, zero), hi = _mm_unpackhi_epi8(dr, zero);
+			__m128i sum_lo = _mm_mullo_epi16(lo, lo), sum_hi = _mm_mullo_epi16(hi, hi);
+			lo = _mm_unpacklo_epi8(dg, zero), hi = _mm_unpackhi_epi8(dg, zero);
+			sum_lo = _mm_add_epi16(sum_lo, _mm_mullo_epi16(lo, lo));
+			sum_hi = _mm_add_epi16(sum_hi, _mm_mullo_epi16(hi, hi));
+			lo = _mm_unpacklo_epi8(db, zero), hi = _mm_unpackhi_epi8(db, zero);
+			sum_lo = _mm_add_epi16(sum_lo, _mm_mullo_epi16(lo, lo));
+			sum_hi = _mm_add_epi16(sum_hi, _mm_mullo_epi16(hi, hi));
+			__m128i match = _mm_packs_epi16(_mm_cmplt_epi16(sum_lo, threshold), _mm_cmplt_epi16(sum_hi, threshold));
+
+			word |= (uint64_t)(uint16_t)_mm_movemask_epi8(match) << (16 * k);
+		}
+		bits[x / 64] = word;
+	}
+	color_mask_scalar(rgb + 3 * x, width - x, target, bits + x / 64);
+}
+
+// 2 x 32 pixels per word
+COLOR_MASK_TARGET("avx2")
+inline void color_mask_avx2(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits)
+{
+	__m256i shuffle[9];
+	color_mask_setup32(shuffle);
+	__m256i red = _mm256_set1_epi8((char)target.red);
+	__m256i green = _mm256_set1_epi8((char)target.green);
+	__m256i blue = _mm256_set1_epi8((char)target.blue);
+	__m256i limit = _mm256_set1_epi8((char)(target.distance + 1));
+	__m256i threshold = _mm256_set1_epi16((short)(target.distance * target.distance));
+	__m256i zero = _mm256_setzero_si256();
+
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 2; k++) {
+			__m256i r, g, bl;
+			color_mask_gather32(rgb + 3 * (x + 32 * k), shuffle, r, g, bl);
+
+			__m256i dr = _mm256_min_epu8(_mm256_or_si256(_mm256_subs_epu8(r, red), _mm256_subs_epu8(red, r)), limit);
+			__m256i dg = _mm256_min_epu8(_mm256_or_si256(_mm256_subs_epu8(g, green), _mm256_subs_epu8(green, g)), limit);
+			__m256i db = _mm256_min_epu8(_mm256_or_si256(_mm256_subs_epu8(bl, blue), _mm256_subs_epu8(blue, bl)), limit);
+
+			__m256i lo = _mm256_unpacklo_epi8(dr, zero), hi = _mm256_unpackhi_epi8(dr, zero);
+			__m256i sum_lo = _mm256_mullo_epi16(lo, lo), sum_hi = _mm256_mullo_epi16(hi, hi);
+			lo = _mm256_unpacklo_epi8(dg, zero), hi = _mm256_unpackhi_epi8(dg, zero);
+			sum_lo = _mm256_add_epi16(sum_lo, _mm256_mullo_epi16(lo, lo));
+			sum_hi = _mm256_add_epi16(sum_hi, _mm256_mullo_epi16(hi, hi));
+			lo = _mm256_unpacklo_epi8(db, zero), hi = _mm256_unpackhi_epi8(db, zero);
+			sum_lo = _mm256_add_epi16(sum_lo, _mm256_mullo_epi16(lo, lo));
+			sum_hi = _mm256_add_epi16(sum_hi, _mm256_mullo_epi16(hi, hi));
+			__m256i match = _mm256_packs_epi16(_mm256_cmpgt_epi16(threshold, sum_lo), _mm256_cmpgt_epi16(threshold, sum_hi));
+
+			word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(match) << (32 * k);
+		}
+		bits[x / 64] = word;
+	}
+	color_mask_scalar(rgb + 3 * x, width - x, target, bits + x / 64);
+}
+
+COLOR_MASK_TARGET("avx512f")
+inline __m512i color_mask_broadcast(const void *p)
+{
+	uint8_t lanes[64];
+	for (int i = 0; i < 4; i++)
+		memcpy(lanes + 16 * i, p, 16);
+	return _mm512_loadu_si512(lanes);
+}
+
+// A whole word at a time, 16 pixels in each of the four 128-bit lanes
+COLOR_MASK_TARGET("avx512f,avx512bw")
+inline void color_mask_avx512(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits)
+{
+	__m512i shuffle[9];
+	for (int i = 0; i < 9; i++)
+		shuffle[i] = color_mask_broadcast(color_mask_shuffles[i]);
+	__m512i red = _mm512_set1_epi8((char)target.red);
+	__m512i green = _mm512_set1_epi8((char)target.green);
+	__m512i blue = _mm512_set1_epi8((char)target.blue);
+	__m512i limit = _mm512_set1_epi8((char)(target.distance + 1));
+	__m512i threshold = _mm512_set1_epi16((short)(target.distance * target.distance));
+	__m512i zero = _mm512_setzero_si512();
+
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		const __m128i *in = (const __m128i *)(rgb + 3 * x);
+		__m512i v[3];
+		for (int k = 0; k < 3; k++) {
+			__m512i w = _mm512_castsi128_si512(_mm_loadu_si128(in + k));
+			w = _mm512_inserti32x4(w, _mm_loadu_si128(in + k + 3), 1);
+			w = _mm512_inserti32x4(w, _mm_loadu_si128(in + k + 6), 2);
+			v[k] = _mm512_inserti32x4(w, _mm_loadu_si128(in + k + 9), 3);
+		}
+		__m512i r = _mm512_or_si512(_mm512_or_si512(_mm512_shuffle_epi8(v[0], shuffle[0]), _mm512_shuffle_epi8(v[1], shuffle[1])), _mm512_shuffle_epi8(v[2], shuffle[2]));
+		__m512i g = _mm512_or_si512(_mm512_or_si512(_mm512_shuffle_epi8(v[0], shuffle[3]), _mm512_shuffle_epi8(v[1], shuffle[4])), _mm512_shuffle_epi8(v[2], shuffle[5]));
+		__m512i bl = _mm512_or_si512(_mm512_or_si512(_mm512_shuffle_epi8(v[0], shuffle[6]), _mm512_shuffle_epi8(v[1], shuffle[7])), _mm512_shuffle_epi8(v[2], shuffle[8]));
+
+		__m512i dr = _mm512_min_epu8(_mm512_or_si512(_mm512_subs_epu8(r, red), _mm512_subs_epu8(red, r)), limit);
+		__m512i dg = _mm512_min_epu8(_mm512_or_si512(_mm512_subs_epu8(g, green), _mm512_subs_epu8(green, g)), limit);
+		__m512i db = _mm512_min_epu8(_mm512_or_si512(_mm512_subs_epu8(bl, blue), _mm512_subs_epu8(blue, bl)), limit);
+
+		__m512i lo = _mm512_unpacklo_epi8(dr, zero), hi = _mm512_unpackhi_epi8(dr, zero);
+		__m512i sum_lo = _mm512_mullo_epi16(lo, lo), sum_hi = _mm512_mullo_epi16(hi, hi);
+		lo = _mm512_unpacklo_epi8(dg, zero), hi = _mm512_unpackhi_epi8(dg, zero);
+		sum_lo = _mm512_add_epi16(sum_lo, _mm512_mullo_epi16(lo, lo));
+		sum_hi = _mm512_add_epi16(sum_hi, _mm512_mullo_epi16(hi, hi));
+		lo = _mm512_unpacklo_epi8(db, zero), hi = _mm512_unpackhi_epi8(db, zero);
+		sum_lo = _mm512_add_epi16(sum_lo, _mm512_mullo_epi16(lo, lo));
+		sum_hi = _mm512_add_epi16(sum_hi, _mm512_mullo_epi16(hi, hi));
+		__m512i match = _mm512_packs_epi16(_mm512_movm_epi16(_mm512_cmplt_epi16_mask(sum_lo, threshold)),
+			_mm512_movm_epi16(_mm512_cmplt_epi16_mask(sum_hi, threshold)));
+
+		bits[x / 64] = (uint64_t)_mm512_movepi8_mask(match);
+	}
+	color_mask_scalar(rgb + 3 * x, width - x, target, bits + x / 64);
+}
+
+// Converts 8 pixels, one channel per 16-bit vector, and tests them against the target.
+// The products stay within 16 bits: luma sums to at most 65280 unsigned, chroma to
+// +-32640 signed
+COLOR_MASK_TARGET("sse4.1")
+inline __m128i chroma_match8(__m128i r, __m128i g, __m128i b, __m128i cb, __m128i cr, __m128i limit,
+	__m128i threshold, __m128i min_luma, __m128i max_luma)
+{
+	__m128i y = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+		_mm_mullo_epi16(g, _mm_set1_epi16(150))), _mm_mullo_epi16(b, _mm_set1_epi16(29))), 8);
+	__m128i dcb = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-43)),
+		_mm_mullo_epi16(g, _mm_set1_epi16(-85))), _mm_slli_epi16(b, 7)), 8);
+	__m128i dcr = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(r, 7),
+		_mm_mullo_epi16(g, _mm_set1_epi16(-107))), _mm_mullo_epi16(b, _mm_set1_epi16(-21))), 8);
+	dcb = _mm_min_epi16(_mm_abs_epi16(_mm_sub_epi16(dcb, cb)), limit);
+	dcr = _mm_min_epi16(_mm_abs_epi16(_mm_sub_epi16(dcr, cr)), limit);
+	__m128i near = _mm_cmplt_epi16(_mm_add_epi16(_mm_mullo_epi16(dcb, dcb), _mm_mullo_epi16(dcr, dcr)), threshold);
+	__m128i lit = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi16(y, min_luma), _mm_cmpgt_epi16(y, max_luma)), near);
+	return lit;
+}
+
+COLOR_MASK_TARGET("sse4.1")
+inline void chroma_mask_sse41(const uint8_t *rgb, int width, const ChromaTarget &target, uint64_t *bits)
+{
+	__m128i shuffle[9];
+	color_mask_setup16(shuffle);
+	__m128i cb = _mm_set1_epi16((short)(target.cb - 128)), cr = _mm_set1_epi16((short)(target.cr - 128));
+	__m128i limit = _mm_set1_epi16((short)(target.distance + 1));
+	__m128i threshold = _mm_set1_epi16((short)(target.distance * target.distance));
+	__m128i min_luma = _mm_set1_epi16((short)target.min_luma), max_luma = _mm_set1_epi16((short)target.max_luma);
+	__m128i zero = _mm_setzero_si128();
+
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i r, g, b;
+			color_mask_gather16(rgb + 3 * (x + 16 * k), shuffle, r, g, b);
+			__m128i lo = chroma_match8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero),
+				cb, cr, limit, threshold, min_luma, max_luma);
+			__m128i hi = chroma_match8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero),
+				cb, cr, limit, threshold, min_luma, max_luma);
+			word |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) << (16 * k);
+		}
+		bits[x / 64] = word;
+	}
+	chroma_mask_scalar(rgb + 3 * x, width - x, target, bits + x / 64);
+}
+
+COLOR_MASK_TARGET("avx2")
+inline __m256i chroma_match16(__m256i r, __m256i g, __m256i b, __m256i cb, __m256i cr, __m256i limit,
+	__m256i threshold, __m256i min_luma, __m256i max_luma)
+{
+	__m256i y = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(77)),
+		_mm256_mullo_epi16(g, _mm256_set1_epi16(150))), _mm256_mullo_epi16(b, _mm256_set1_epi16(29))), 8);
+	__m256i dcb = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(-43)),
+		_mm256_mullo_epi16(g, _mm256_set1_epi16(-85))), _mm256_slli_epi16(b, 7)), 8);
+	__m256i dcr = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_slli_epi16(r, 7),
+		_mm256_mullo_epi16(g, _mm256_set1_epi16(-107))), _mm256_mullo_epi16(b, _mm256_set1_epi16(-21))), 8);
+	dcb = _mm256_min_epi16(_mm256_abs_epi16(_mm256_sub_epi16(dcb, cb)), limit);
+	dcr = _mm256_min_epi16(_mm256_abs_epi16(_mm256_sub_epi16(dcr, cr)), limit);
+	__m256i near = _mm256_cmpgt_epi16(threshold, _mm256_add_epi16(_mm256_mullo_epi16(dcb, dcb), _mm256_mullo_epi16(dcr, dcr)));
+	return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi16(min_luma, y), _mm256_cmpgt_epi16(y, max_luma)), near);
+}
+
+COLOR_MASK_TARGET("avx2")
+inline void chroma_mask_avx2(const uint8_t *rgb, int width, const ChromaTarget &target, uint64_t *bits)
+{
+	__m256i shuffle[9];
+	color_mask_setup32(shuffle);
+	__m256i cb = _mm256_set1_epi16((short)(target.cb - 128)), cr = _mm256_set1_epi16((short)(target.cr - 128));
+	__m256i limit = _mm256_set1_epi16((short)(target.distance + 1));
+	__m256i threshold = _mm256_set1_epi16((short)(target.distance * target.distance));
+	__m256i min_luma = _mm256_set1_epi16((short)target.min_luma), max_luma = _mm256_set1_epi16((short)target.max_luma);
+	__m256i zero = _mm256_setzero_si256();
+
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		uint64_t word = 0;
+		for (int k = 0; k < 2; k++) {
+			__m256i r, g, b;
+			color_mask_gather32(rgb + 3 * (x + 32 * k), shuffle, r, g, b);
+			__m256i lo = chroma_match16(_mm256_unpacklo_epi8(r, zero), _mm256_unpacklo_epi8(g, zero), _mm256_unpacklo_epi8(b, zero),
+				cb, cr, limit, threshold, min_luma, max_luma);
+			__m256i hi = chroma_match16(_mm256_unpackhi_epi8(r, zero), _mm256_unpackhi_epi8(g, zero), _mm256_unpackhi_epi8(b, zero),
+				cb, cr, limit, threshold, min_luma, max_luma);
+			word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_packs_epi16(lo, hi)) << (32 * k);
+		}
+		bits[x / 64] = word;
+	}
+	chroma_mask_scalar(rgb + 3 * x, width - x, target, bits + x / 64);
+}
+
+// 8 depths per vector, in range where clamping to the band leaves them unchanged. Words
+// that are already clear are skipped without reading their depths
+COLOR_MASK_TARGET("sse4.1")
+inline void depth_band_sse41(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits)
+{
+	// Clamping to an inverted band gives its max, so the depths equal to it would pass
+	if (band.min > band.max) {
+		depth_band_scalar(depth, width, band, bits);
+		return;
+	}
+	__m128i low = _mm_set1_epi16((short)band.min), high = _mm_set1_epi16((short)band.max);
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		if (!bits[x / 64])
+			continue;
+		uint64_t word = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i d0 = _mm_loadu_si128((const __m128i *)(depth + x + 16 * k));
+			__m128i d1 = _mm_loadu_si128((const __m128i *)(depth + x + 16 * k + 8));
+			__m128i in0 = _mm_cmpeq_epi16(_mm_min_epu16(_mm_max_epu16(d0, low), high), d0);
+			__m128i in1 = _mm_cmpeq_epi16(_mm_min_epu16(_mm_max_epu16(d1, low), high), d1);
+			word |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(in0, in1)) << (16 * k);
+		}
+		bits[x / 64] &= word;
+	}
+	depth_band_scalar(depth + x, width - x, band, bits + x / 64);
+}
+
+// 16 depths per vector. Packing works within 128-bit lanes, a permute puts the bytes back
+// in pixel order
+COLOR_MASK_TARGET("avx2")
+inline void depth_band_avx2(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits)
+{
+	// Clamping to an inverted band gives its max, so the depths equal to it would pass
+	if (band.min > band.max) {
+		depth_band_scalar(depth, width, band, bits);
+		return;
+	}
+	__m256i low = _mm256_set1_epi16((short)band.min), high = _mm256_set1_epi16((short)band.max);
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		if (!bits[x / 64])
+			continue;
+		uint64_t word = 0;
+		for (int k = 0; k < 2; k++) {
+			__m256i d0 = _mm256_loadu_si256((const __m256i *)(depth + x + 32 * k));
+			__m256i d1 = _mm256_loadu_si256((const __m256i *)(depth + x + 32 * k + 16));
+			__m256i in0 = _mm256_cmpeq_epi16(_mm256_min_epu16(_mm256_max_epu16(d0, low), high), d0);
+			__m256i in1 = _mm256_cmpeq_epi16(_mm256_min_epu16(_mm256_max_epu16(d1, low), high), d1);
+			__m256i in = _mm256_permute4x64_epi64(_mm256_packs_epi16(in0, in1), 0xD8);
+			word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << (32 * k);
+		}
+		bits[x / 64] &= word;
+	}
+	depth_band_scalar(depth + x, width - x, band, bits + x / 64);
+}
+
+// 32 depths per vector, compared straight into mask registers
+COLOR_MASK_TARGET("avx512f,avx512bw")
+inline void depth_band_avx512(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits)
+{
+	__m512i low = _mm512_set1_epi16((short)band.min), high = _mm512_set1_epi16((short)band.max);
+	int x = 0;
+	for (; x + 64 <= width; x += 64) {
+		if (!bits[x / 64])
+			continue;
+		__m512i d0 = _mm512_loadu_si512(depth + x), d1 = _mm512_loadu_si512(depth + x + 32);
+		uint64_t in0 = _mm512_mask_cmple_epu16_mask(_mm512_cmpge_epu16_mask(d0, low), d0, high);
+		uint64_t in1 = _mm512_mask_cmple_epu16_mask(_mm512_cmpge_epu16_mask(d1, low), d1, high);
+		bits[x / 64] &= in0 | in1 << 32;
+	}
+	depth_band_scalar(depth + x, width - x, band, bits + x / 64);
+}
+#endif
+
+// The widest instruction set the CPU and the OS support
+inline ColorMaskIsa color_mask_best_isa()
+{
+#ifdef COLOR_MASK_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	bool os_avx512 = os_avx && (_xgetbv(0) & 0xE6) == 0xE6;
+	bool avx2 = false, avx512 = false;
+	if (max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+		avx512 = os_avx512 && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+	bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	if (avx512)
+		return COLOR_MASK_AVX512;
+	if (avx2)
+		return COLOR_MASK_AVX2;
+	if (sse41)
+		return COLOR_MASK_SSE41;
+#endif
+	return COLOR_MASK_SCALAR;
+}
+
+inline const char *color_mask_isa_name(ColorMaskIsa isa)
+{
+	static const char *names[] = { "scalar", "sse4.1", "avx2", "avx512" };
+	return names[isa];
+}
+
+// Kernel for an instruction set, which the caller checked is supported. Distances the
+// vector kernels cannot represent always use the scalar one
+inline ColorMaskKernel color_mask_kernel(ColorMaskIsa isa, const ColorTarget &target)
+{
+	if (target.distance < 0 || target.distance > COLOR_MASK_SIMD_DISTANCE)
+		return color_mask_scalar;
+#ifdef COLOR_MASK_X86
+	switch (isa) {
+	case COLOR_MASK_AVX512: return color_mask_avx512;
+	case COLOR_MASK_AVX2: return color_mask_avx2;
+	case COLOR_MASK_SSE41: return color_mask_sse41;
+	default: break;
+	}
+#endif
+	return color_mask_scalar;
+}
+
+// Masks a row with the fastest kernel for this CPU, picked on the first call
+inline void color_mask(const uint8_t *rgb, int width, const ColorTarget &target, uint64_t *bits)
+{
+	static const ColorMaskIsa isa = color_mask_best_isa();
+	color_mask_kernel(isa, target)(rgb, width, target, bits);
+}
+
+// Chroma kernel for an instruction set. There is no AVX-512 one, AVX2 is used instead
+inline ChromaMaskKernel chroma_mask_kernel(ColorMaskIsa isa, const ChromaTarget &target)
+{
+	if (target.distance < 0 || target.distance > CHROMA_MASK_SIMD_DISTANCE)
+		return chroma_mask_scalar;
+#ifdef COLOR_MASK_X86
+	switch (isa) {
+	case COLOR_MASK_AVX512:
+	case COLOR_MASK_AVX2: return chroma_mask_avx2;
+	case COLOR_MASK_SSE41: return chroma_mask_sse41;
+	default: break;
+	}
+#endif
+	return chroma_mask_scalar;
+}
+
+inline void chroma_mask(const uint8_t *rgb, int width, const ChromaTarget &target, uint64_t *bits)
+{
+	static const ColorMaskIsa isa = color_mask_best_isa();
+	chroma_mask_kernel(isa, target)(rgb, width, target, bits);
+}
+
+inline DepthBandKernel depth_band_kernel(ColorMaskIsa isa)
+{
+#ifdef COLOR_MASK_X86
+	switch (isa) {
+	case COLOR_MASK_AVX512: return depth_band_avx512;
+	case COLOR_MASK_AVX2: return depth_band_avx2;
+	case COLOR_MASK_SSE41: return depth_band_sse41;
+	default: break;
+	}
+#endif
+	return depth_band_scalar;
+}
+
+inline void depth_band(const uint16_t *depth, int width, const DepthBand &band, uint64_t *bits)
+{
+	static const DepthBandKernel kernel = depth_band_kernel(color_mask_best_isa());
+	kernel(depth, width, band, bits);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Reports files of a directory once they have been written, or renamed into it.
+// Uses inotify on Linux, and on Windows a change notification plus a scan of write times.
+// When the notification cannot be set up, which is reported on stderr, the directory's
+// write times are scanned on every timeout instead
+class DirectoryWatcher {
+public:
+	DirectoryWatcher(const std::string &dir) : _dir(dir)
+	{
+#ifdef _WIN32
+		_change = FindFirstChangeNotificationA(_dir.c_str(), FALSE,
+			FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+		if (_change == INVALID_HANDLE_VALUE)
+			fprintf(stderr, "Cannot watch %s (error %lu), polling it instead\n", _dir.c_str(), GetLastError());
+#else
+		_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_fd >= 0 && inotify_add_watch(_fd, _dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			int error = errno;
+			close(_fd);
+			_fd = -1;
+			errno = error;
+		}
+		if (_fd < 0)
+			fprintf(stderr, "Cannot watch %s (%s), polling it instead\n", _dir.c_str(), strerror(errno));
+#endif
+		std::vector<std::string> ignored;
+		scan(ignored);
+	}
+
+	~DirectoryWatcher()
+	{
+#ifdef _WIN32
+		if (_change != INVALID_HANDLE_VALUE)
+			FindCloseChangeNotification(_change);
+#else
+		if (_fd >= 0)
+			close(_fd);
+#endif
+	}
+
+	// Waits up to timeout_ms for changes and appends the changed file names
+	void wait(int timeout_ms, std::vector<std::string> &names)
+	{
+#ifdef _WIN32
+		if (_change == INVALID_HANDLE_VALUE)
+			Sleep(timeout_ms);
+		else if (WaitForSingleObject(_change, timeout_ms) == WAIT_OBJECT_0)
+			FindNextChangeNotification(_change);
+		// Notifications may arrive before the writer is done, so rescan on every timeout
+		scan(names);
+#else
+		if (_fd < 0) {
+			usleep(timeout_ms * 1000);
+			scan(names);
+			return;
+		}
+		struct pollfd pfd = { _fd, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return;
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t len;
+		while ((len = read(_fd, buffer, sizeof(buffer))) > 0) {
+			for (char *p = buffer; p < buffer + len; ) {
+				struct inotify_event *event = (struct inotify_event *)p;
+				if (event->len)
+					names.push_back(event->name);
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+#endif
+	}
+
+private:
+	DirectoryWatcher(const DirectoryWatcher &);
+	DirectoryWatcher &operator=(const DirectoryWatcher &);
+
+	std::string _dir;
+#ifdef _WIN32
+	void scan(std::vector<std::string> &names)
+	{
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((_dir + "\\*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+			return;
+		do {
+			if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			ULONGLONG written = ((ULONGLONG)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+			std::map<std::string, ULONGLONG>::iterator it = _written.find(data.cFileName);
+			if (it == _written.end() || it->second != written) {
+				_written[data.cFileName] = written;
+				names.push_back(data.cFileName);
+			}
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+
+	HANDLE _change;
+	std::map<std::string, ULONGLONG> _written;
+#else
+	// Appends the files whose write time or size changed since the last scan. Only used
+	// without inotify
+	void scan(std::vector<std::string> &names)
+	{
+		if (_fd >= 0)
+			return;
+		DIR *dir = opendir(_dir.c_str());
+		if (!dir)
+			return;
+		while (struct dirent *entry = readdir(dir)) {
+			struct stat info;
+			if (stat((_dir + "/" + entry->d_name).c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+				continue;
+			Written written = { (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec, (long long)info.st_size };
+			std::map<std::string, Written>::iterator it = _written.find(entry->d_name);
+			if (it == _written.end() || it->second.time != written.time || it->second.size != written.size) {
+				_written[entry->d_name] = written;
+				names.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+	}
+
+	struct Written {
+		long long time, size;
+	};
+
+	int _fd;
+	std::map<std::string, Written> _written;
+#endif
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+// Bump allocator for data that only lives for one frame: allocating moves a pointer, and
+// reset() drops everything at once in O(1), nothing is freed piece by piece. A frame that
+// needs more than the block holds spills into extra blocks, and the next reset() replaces
+// them all with a single block as large as that frame needed, so the arena stops touching
+// the heap once it has seen its largest frame. allocations() counts the blocks it took
+// from the heap, which stays put in the steady state
+class FrameArena {
+public:
+	FrameArena(size_t capacity = 0) : _block(NULL), _capacity(0), _used(0), _spilled(0), _allocations(0)
+	{
+		if (capacity)
+			replace(capacity);
+	}
+
+	~FrameArena()
+	{
+		release_spills();
+		free(_block);
+	}
+
+	// Uninitialized room for count objects of T, aligned for any of the types the
+	// localizer keeps. Stays valid until the next reset()
+	template <class T>
+	T *allocate(size_t count)
+	{
+		size_t bytes = (count * sizeof(T) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+		if (_used + bytes <= _capacity) {
+			T *p = (T *)(_block + _used);
+			_used += bytes;
+			return p;
+		}
+		// Spill, and remember how much the frame needed in all
+		void *p = malloc(bytes ? bytes : ARENA_ALIGN);
+		if (!p)
+			throw std::bad_alloc();
+		_allocations++;
+		_spills.push_back(p);
+		_spilled += bytes;
+		return (T *)p;
+	}
+
+	// Drops everything allocated since the last reset
+	void reset()
+	{
+		if (_spilled) {
+			size_t needed = _used + _spilled;
+			release_spills();
+			replace(needed + needed / 4);
+		}
+		_used = 0;
+	}
+
+	size_t used() const { return _used + _spilled; }
+	size_t capacity() const { return _capacity; }
+	unsigned long long allocations() const { return _allocations; }
+
+private:
+	FrameArena(const FrameArena &);
+	FrameArena &operator=(const FrameArena &);
+
+	static const size_t ARENA_ALIGN = 64;
+
+	void replace(size_t capacity)
+	{
+		capacity = (capacity + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+		free(_block);
+		_block = (char *)malloc(capacity);
+		if (!_block) {
+			_capacity = 0;
+			throw std::bad_alloc();
+		}
+		_allocations++;
+		_capacity = capacity;
+	}
+
+	void release_spills()
+	{
+		for (size_t i = 0; i < _spills.size(); i++)
+			free(_spills[i]);
+		_spills.clear();
+		_spilled = 0;
+	}
+
+	char *_block;  // malloc aligns to 16 bytes, ARENA_ALIGN rounds sizes only
+	size_t _capacity, _used, _spilled;
+	std::vector<void *> _spills;
+	unsigned long long _allocations;
+};
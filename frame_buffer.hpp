@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+
+// Lock-free single producer / single consumer handoff where the newest item wins.
+// The producer fills back() and publishes it, the consumer acquires the newest
+// published item into front(). Neither side ever waits for the other
+template <class T>
+class TripleBuffer {
+public:
+	TripleBuffer() : _back(0), _middle(1), _front(2) {}
+
+	T &back() { return _slots[_back]; }
+	T &front() { return _slots[_front]; }
+
+	// Hands back() to the consumer, returns true when it replaced an item that was never
+	// acquired
+	bool publish()
+	{
+		int old = _middle.exchange(_back | FRESH);
+		_back = old & INDEX;
+		return (old & FRESH) != 0;
+	}
+
+	// Whether an item was published since the last acquire()
+	bool ready() const { return (_middle.load() & FRESH) != 0; }
+
+	// Moves the newest published item to front(), returns false when there is none
+	// since the last call
+	bool acquire()
+	{
+		if (!(_middle.load() & FRESH))
+			return false;
+		_front = _middle.exchange(_front) & INDEX;
+		return true;
+	}
+
+private:
+	static const int INDEX = 3;
+	static const int FRESH = 4;
+
+	T _slots[3];
+	int _back;
+	std::atomic<int> _middle; // slot index, plus FRESH once published
+	int _front;
+};
+
+// Runs a FrameSource on its own thread and hands over only the newest frame, so the
+// processing loop never waits on the camera when a frame is ready and never works on
+// a stale one. Frames are copied into the buffer slots, which are reused. The handoff
+// itself takes no lock: the mutex only puts the processing loop to sleep when it has
+// caught up with the camera, and wakes it on the next frame
+class CaptureThread : public FrameSource {
+public:
+	CaptureThread(FrameSource &source)
+		: _source(source), _stop(false), _done(false), _skipped(0), _thread([this] { run(); }) {}
+
+	~CaptureThread()
+	{
+		_stop = true;
+		_thread.join();
+	}
+
+	// Waits for a frame newer than the last one returned. The view stays valid until the
+	// next call. Returns false once the source is exhausted, and rethrows its errors
+	bool next(FrameView &frame) override
+	{
+		if (!_buffer.acquire()) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			_published.wait(lock, [this] { return _buffer.ready() || _done; });
+			if (!_buffer.acquire()) {
+				if (_error)
+					std::rethrow_exception(_error);
+				return false;
+			}
+		}
+		frame = _buffer.front().view;
+		return true;
+	}
+
+	// Frames replaced by a newer one before processing picked them up
+	unsigned long long skipped() const { return _skipped; }
+
+private:
+	CaptureThread(const CaptureThread &);
+	CaptureThread &operator=(const CaptureThread &);
+
+	struct Slot {
+		std::vector<uint16_t> depth;
+		std::vector<uint8_t> color;
+		FrameView view;
+	};
+
+	void run()
+	{
+		try {
+			FrameView frame;
+			while (!_stop && _source.next(frame)) {
+				Slot &slot = _buffer.back();
+				slot.depth.assign(frame.depth, frame.depth + frame.width * frame.height);
+				slot.color.assign(frame.color, frame.color + frame.width * frame.height * 3);
+				slot.view = frame;
+				slot.view.depth = &slot.depth[0];
+				slot.view.color = &slot.color[0];
+
+				if (_buffer.publish())
+					_skipped++;
+				wake();
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_done = true;
+		}
+		_published.notify_one();
+	}
+
+	// Taking the mutex orders the wakeup after a consumer that is checking for a frame
+	// has gone to sleep, so it cannot be missed
+	void wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+		_published.notify_one();
+	}
+
+	FrameSource &_source;
+	TripleBuffer<Slot> _buffer;
+	std::atomic<bool> _stop;
+	bool _done;
+	std::exception_ptr _error;
+	std::atomic<unsigned long long> _skipped;
+	std::mutex _mutex;
+	std::condition_variable _published;
+	std::thread _thread;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Depth stream calibration, mirroring the fields of rs2_intrinsics that the
+// localizer needs so it can run without librealsense
+struct Intrinsics {
+	int width, height;
+	float ppx, ppy;          // principal point, in pixels
+	float fx, fy;            // focal length, in pixels
+	int inverse_brown_conrady; // distortion model, non-zero for RS2_DISTORTION_INVERSE_BROWN_CONRADY
+	float coeffs[5];
+	float depth_scale;       // meters per Z16 unit
+};
+
+// One depth+color frame pair. Depth is Z16 and color is RGB8, both width x height
+// and pixel-aligned. The pointers belong to the source and stay valid until its
+// next call to next()
+struct FrameView {
+	const uint16_t *depth;
+	const uint8_t *color;
+	int width, height;
+	Intrinsics intrin;
+	double timestamp;        // milliseconds
+	unsigned long long number;
+};
+
+// Anything that produces frames for the localizer: a live camera, a recording or a
+// synthetic scene
+class FrameSource {
+public:
+	virtual ~FrameSource() {}
+
+	// Blocks until the next frame is available, returns false once the source is exhausted
+	virtual bool next(FrameView &frame) = 0;
+};
+
+// Nominal intrinsics of a D400 depth stream scaled to the requested resolution
+inline Intrinsics default_intrinsics(int width, int height)
+{
+	Intrinsics intrin;
+	memset(&intrin, 0, sizeof(intrin));
+	intrin.width = width;
+	intrin.height = height;
+	intrin.ppx = width / 2.0f;
+	intrin.ppy = height / 2.0f;
+	intrin.fx = intrin.fy = 615.0f * width / 640.0f;
+	intrin.depth_scale = 0.001f;
+	return intrin;
+}
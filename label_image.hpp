@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "color_lut.hpp"
+#include "color_mask.hpp"
+#include "frame_arena.hpp"
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// Label images hold one class byte per pixel, 0 for background
+const int LABEL_CLASSES = 255;
+
+// Color model of several targets. A pixel belongs to the nearest target it matches,
+// target i being class i + 1
+inline ColorPredicate target_classes(const std::vector<ColorTarget> &targets)
+{
+	return [targets](uint8_t r, uint8_t g, uint8_t b) -> uint8_t {
+		uint8_t best = 0;
+		int best_distance = 0;
+		for (size_t i = 0; i < targets.size() && i < (size_t)LABEL_CLASSES; i++) {
+			int dr = r - targets[i].red, dg = g - targets[i].green, db = b - targets[i].blue;
+			int distance = dr * dr + dg * dg + db * db;
+			if (distance < targets[i].distance * targets[i].distance && (!best || distance < best_distance)) {
+				best = (uint8_t)(i + 1);
+				best_distance = distance;
+			}
+		}
+		return best;
+	};
+}
+
+// Classifies every pixel of the frame in a single pass, whatever the number of classes
+inline void build_labels(const FrameView &frame, const ColorLut &lut, uint8_t *labels)
+{
+	const uint8_t *rgb = frame.color;
+	size_t pixels = (size_t)frame.width * frame.height;
+	for (size_t i = 0; i < pixels; i++)
+		labels[i] = lut.classify(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+// Two-pass connected component labeling of a class image into a flat array of uint32
+// labels. The first pass gives each pixel the provisional label of its left or top
+// neighbor of the same class (4-connected), a new one when neither is, and joins the two
+// through union-find when both are, their sums merging along. The second pass rewrites
+// every provisional label to its component's. Linear in the pixels whatever the blobs'
+// shapes, with no allocation per pixel: the arrays are reused from frame to frame
+class ComponentLabeler {
+public:
+	// Component of every pixel of the last image, 0 for background and i + 1 for
+	// components()[i]
+	const std::vector<uint32_t> &labels() const { return _labels; }
+
+	// Components in the order of their first pixel, and their classes
+	const std::vector<BlobStats> &components() const { return _components; }
+	const std::vector<uint8_t> &classes() const { return _classes; }
+
+	// Labels the pixels of class image that are not background. The sums include vertices
+	// only when given, the sizes, bounding boxes and pixel moments always
+	void label(const FrameView &frame, const uint8_t *image, const Point3 *vertices = NULL)
+	{
+		int W = frame.width, H = frame.height;
+		_labels.resize((size_t)W * H);
+		_sets.clear();
+		_owner.clear();
+
+		uint32_t *labels = &_labels[0];
+		for (int y = 0; y < H; y++) {
+			for (int x = 0; x < W; x++) {
+				int i = y * W + x;
+				uint8_t c = image[i];
+				if (!c) {
+					labels[i] = 0;
+					continue;
+				}
+				// Provisional labels are stored plus one, 0 is background
+				bool left = x > 0 && image[i - 1] == c, top = y > 0 && image[i - W] == c;
+				uint32_t label;
+				if (left) {
+					label = _sets.find(labels[i - 1] - 1);
+					if (top)
+						label = _sets.merge(label, labels[i - W] - 1);
+				}
+				else if (top)
+					label = _sets.find(labels[i - W] - 1);
+				else {
+					label = _sets.add(i, x, y);
+					_owner.push_back(c);
+				}
+				labels[i] = label + 1;
+
+				BlobStats &stats = _sets.stats(label);
+				if (vertices)
+					accumulate(stats, frame, vertices, x, y);
+				else
+					add_pixel(stats, x, y);
+			}
+		}
+
+		// Room for twice as many labels in every per-label array whenever they run out, so
+		// a slowly rising count does not allocate every frame
+		if (_final.capacity() < _sets.size()) {
+			uint32_t room = 2 * _sets.size();
+			_sets.reserve(room);
+			_owner.reserve(room);
+			_final.reserve(room);
+			_components.reserve(room);
+			_classes.reserve(room);
+		}
+
+		// Roots are the oldest labels of their sets, so numbering them in order numbers
+		// the components by first pixel
+		_components.clear();
+		_classes.clear();
+		_final.resize(_sets.size());
+		for (uint32_t i = 0; i < _sets.size(); i++) {
+			if (_sets.root(i)) {
+				_components.push_back(_sets.stats(i));
+				_classes.push_back(_owner[i]);
+				_final[i] = (uint32_t)_components.size();
+			}
+		}
+		for (uint32_t i = 0; i < _sets.size(); i++)
+			_final[i] = _final[_sets.find(i)];
+		for (size_t i = 0; i < _labels.size(); i++)
+			if (labels[i])
+				labels[i] = _final[labels[i] - 1];
+	}
+
+private:
+	std::vector<uint32_t> _labels;
+	BlobSets _sets;
+	std::vector<uint8_t> _owner;   // class of every provisional label
+	std::vector<uint32_t> _final;  // component of every provisional label
+	std::vector<BlobStats> _components;
+	std::vector<uint8_t> _classes;
+};
+
+// Separates the label image into blobs of every class at once, and averages the vertices
+// of the largest blob of each. results[c - 1] receives class c. Without vertices only the
+// pixels of those blobs are deprojected, found in their bounding boxes by component. The
+// per-class scratch comes from arena
+inline void localize_labels(const FrameView &frame, const uint8_t *labels, int classes, const Point3 *vertices,
+	Localization *results, ComponentLabeler &labeler, FrameArena &arena)
+{
+	labeler.label(frame, labels, vertices);
+	const std::vector<BlobStats> &components = labeler.components();
+	const std::vector<uint8_t> &owners = labeler.classes();
+
+	// The first of the largest blobs of each class, in raster order
+	int *largest = arena.allocate<int>(classes);
+	for (int c = 0; c < classes; c++) {
+		largest[c] = -1;
+		Localization empty = { 0, 0, 0, 0, 0, 0 };
+		results[c] = empty;
+	}
+	for (size_t i = 0; i < components.size(); i++) {
+		int c = owners[i] - 1;
+		if (c >= classes)
+			continue;
+		results[c].blobs++;
+		if (largest[c] < 0 || components[largest[c]].size < components[i].size)
+			largest[c] = (int)i;
+	}
+
+	for (int c = 0; c < classes; c++) {
+		if (largest[c] < 0)
+			continue;
+		BlobStats blob = components[largest[c]];
+		if (!vertices) {
+			uint32_t id = (uint32_t)largest[c] + 1;
+			const uint32_t *ids = &labeler.labels()[0];
+			for (int y = blob.top; y <= blob.bottom; y++) {
+				for (int x = blob.left; x <= blob.right; x++) {
+					if (ids[y * frame.width + x] != id)
+						continue;
+					add_vertex(blob, vertex_at(frame, NULL, x, y));
+				}
+			}
+		}
+		fill_result(&blob, results[c]);
+	}
+}
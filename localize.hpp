@@ -0,0 +1,646 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "bit_mask.hpp"
+#include "color_lut.hpp"
+#include "color_mask.hpp"
+#include "frame_source.hpp"
+
+const int TARGET_RED = 0xC0;
+const int TARGET_GREEN = 0x10;
+const int TARGET_BLUE = 0x10;
+const int TARGET_DIST = 90;
+const ColorTarget TARGET = { TARGET_RED, TARGET_GREEN, TARGET_BLUE, TARGET_DIST };
+
+// TARGET as a color model, to build lookup tables from
+inline uint8_t target_predicate(uint8_t r, uint8_t g, uint8_t b)
+{
+	int dr = r - TARGET_RED, dg = g - TARGET_GREEN, db = b - TARGET_BLUE;
+	return dr * dr + dg * dg + db * db < TARGET_DIST * TARGET_DIST;
+}
+
+// Same layout as rs2::vertex, so pc.calculate() output can be passed straight in
+struct Point3 {
+	float x, y, z;
+};
+
+// Centroid of the largest target-colored blob
+struct Localization {
+	float x, y, z;
+	int count; // pixels of the blob with depth data
+	int size;  // pixels of the blob
+	int blobs;
+};
+
+/* Given pixel coordinates and depth in an image with no distortion or inverse distortion coefficients, compute the corresponding point in 3D space relative to the same camera */
+inline void deproject_pixel_to_point(float point[3], const Intrinsics &intrin, const float pixel[2], float depth)
+{
+	float x = (pixel[0] - intrin.ppx) / intrin.fx;
+	float y = (pixel[1] - intrin.ppy) / intrin.fy;
+	if (intrin.inverse_brown_conrady)
+	{
+		float r2 = x * x + y * y;
+		float f = 1 + intrin.coeffs[0] * r2 + intrin.coeffs[1] * r2*r2 + intrin.coeffs[4] * r2*r2*r2;
+		float ux = x * f + 2 * intrin.coeffs[2] * x*y + intrin.coeffs[3] * (r2 + 2 * x*x);
+		float uy = y * f + 2 * intrin.coeffs[3] * x*y + intrin.coeffs[2] * (r2 + 2 * y*y);
+		x = ux;
+		y = uy;
+	}
+	point[0] = depth * x;
+	point[1] = depth * y;
+	point[2] = depth;
+}
+
+// Headless equivalent of rs2::pointcloud::calculate(), one vertex per depth pixel
+inline void calculate_points(const FrameView &frame, Point3 *vertices)
+{
+	for (int y = 0; y < frame.height; y++) {
+		for (int x = 0; x < frame.width; x++) {
+			int i = x + y * frame.width;
+			float pixel[2] = { (float)x, (float)y };
+			deproject_pixel_to_point(&vertices[i].x, frame.intrin, pixel, frame.depth[i] * frame.intrin.depth_scale);
+		}
+	}
+}
+
+// Vertex of depth pixel (x, y). Taken from vertices when given, otherwise deprojected from
+// the depth plane on the spot, so only the pixels actually used cost anything
+inline Point3 vertex_at(const FrameView &frame, const Point3 *vertices, int x, int y)
+{
+	int i = x + y * frame.width;
+	if (vertices)
+		return vertices[i];
+	Point3 vertex = { 0, 0, 0 };
+	if (frame.depth[i]) {
+		float pixel[2] = { (float)x, (float)y };
+		deproject_pixel_to_point(&vertex.x, frame.intrin, pixel, frame.depth[i] * frame.intrin.depth_scale);
+	}
+	return vertex;
+}
+
+// How build_mask picks target pixels. Without one, by the TARGET color sphere
+struct Segmentation {
+	const ColorLut *lut;         // classify through a lookup table, when set
+	const ChromaTarget *chroma;  // otherwise threshold chroma and luma, when set
+	const DepthBand *depth;      // and drop pixels whose depth is outside this band, when set
+};
+
+// Masks pixels left to left + width - 1 of row y of the frame into bits, which holds the
+// whole row. left is a multiple of 64, a negative width stands for the rest of the row
+inline void mask_row(const FrameView &frame, int y, const Segmentation *segmentation, uint64_t *bits,
+	int left = 0, int width = -1)
+{
+	const uint8_t *rgb = frame.color + (size_t)3 * (y * frame.width + left);
+	if (width < 0)
+		width = frame.width - left;
+	bits += left / 64;
+	if (segmentation && segmentation->lut)
+		color_lut_mask(rgb, width, *segmentation->lut, bits);
+	else if (segmentation && segmentation->chroma)
+		chroma_mask(rgb, width, *segmentation->chroma, bits);
+	else
+		color_mask(rgb, width, TARGET, bits);
+	if (segmentation && segmentation->depth)
+		depth_band(frame.depth + (size_t)y * frame.width + left, width, *segmentation->depth, bits);
+}
+
+// Create mask by filtering RGB values, one row at a time
+inline void build_mask(const FrameView &frame, BitMask &mask, const Segmentation *segmentation = NULL)
+{
+	mask.resize(frame.width, frame.height);
+	for (int y = 0; y < frame.height; y++)
+		mask_row(frame, y, segmentation, mask.row(y));
+}
+
+// Rectangle of pixels, inclusive
+struct Window {
+	int left, top, right, bottom;
+};
+
+// Sums over the pixels of a blob, accumulated while labeling so that nothing needs to
+// go over its pixels again: the centroid, the spread and the orientation all follow
+// from these moments
+struct BlobStats {
+	int size;                      // pixels
+	int count;                     // pixels with depth data
+	double x, y, z;                // vertex sums over those
+	int first;                     // raster index of the first pixel
+	int left, top, right, bottom;  // bounding box, inclusive
+	double px, py;                 // pixel coordinate sums
+	double pxx, pyy, pxy;          // and sums of their squares and products
+};
+
+// Adds pixel (x, y) to the blob's size, bounding box as the sweep goes down, and pixel
+// moments. Integer moments are exact in doubles up to 2^53, far beyond any frame
+inline void add_pixel(BlobStats &stats, int x, int y)
+{
+	stats.size++;
+	if (x < stats.left)
+		stats.left = x;
+	if (x > stats.right)
+		stats.right = x;
+	stats.bottom = y;
+	stats.px += x;
+	stats.py += y;
+	stats.pxx += (double)x * x;
+	stats.pyy += (double)y * y;
+	stats.pxy += (double)x * y;
+}
+
+// Adds a vertex to the blob's vertex sums. Pixels without depth data deproject to the
+// origin and are skipped
+inline void add_vertex(BlobStats &stats, const Point3 &vertex)
+{
+	if (vertex.z) {
+		stats.x += vertex.x;
+		stats.y += vertex.y;
+		stats.z += vertex.z;
+		stats.count++;
+	}
+}
+
+// Without distortion a vertex is linear in its depth d, x d and y d, so the vertex sums of
+// a blob follow from the sums of those over its pixels, deprojected once for the blob by
+// deproject_sums(). Clutter then costs a few additions per pixel rather than a
+// deprojection. Vertices given up front are summed as they are
+inline bool sums_depth(const FrameView &frame, const Point3 *vertices)
+{
+	return !vertices && !frame.intrin.inverse_brown_conrady;
+}
+
+// Adds pixels left to right of row y to the blob's depth sums, x d, y d and d in depth
+// units, held in its vertex sums until deproject_sums()
+inline void add_depth(BlobStats &stats, const FrameView &frame, int left, int right, int y)
+{
+	const uint16_t *depth = frame.depth + (size_t)y * frame.width;
+	uint64_t sum = 0, weighted = 0;
+	int count = 0;
+	for (int x = left; x <= right; x++) {
+		uint32_t d = depth[x];
+		sum += d;
+		weighted += (uint64_t)x * d;
+		count += d != 0;
+	}
+	stats.x += (double)weighted;
+	stats.y += (double)y * sum;
+	stats.z += (double)sum;
+	stats.count += count;
+}
+
+// Turns the depth sums of a blob into the sums of its vertices. Integer sums are exact
+// in doubles, 12 bits of x, 16 of depth and 23 of pixel count fitting in 53
+inline void deproject_sums(BlobStats &stats, const Intrinsics &intrin)
+{
+	double z = stats.z * intrin.depth_scale;
+	stats.x = (stats.x * intrin.depth_scale - intrin.ppx * z) / intrin.fx;
+	stats.y = (stats.y * intrin.depth_scale - intrin.ppy * z) / intrin.fy;
+	stats.z = z;
+}
+
+// Adds pixel (x, y) to the blob, its vertex or depth sums included as sums_depth() says
+inline void accumulate(BlobStats &stats, const FrameView &frame, const Point3 *vertices, int x, int y)
+{
+	add_pixel(stats, x, y);
+	if (sums_depth(frame, vertices))
+		add_depth(stats, frame, x, x, y);
+	else
+		add_vertex(stats, vertex_at(frame, vertices, x, y));
+}
+
+// Adds the sums of one part of a blob into another, the one holding its first pixel
+inline void add_stats(BlobStats &into, const BlobStats &from)
+{
+	into.size += from.size;
+	into.count += from.count;
+	into.x += from.x;
+	into.y += from.y;
+	into.z += from.z;
+	into.left = from.left < into.left ? from.left : into.left;
+	into.top = from.top < into.top ? from.top : into.top;
+	into.right = from.right > into.right ? from.right : into.right;
+	into.bottom = from.bottom > into.bottom ? from.bottom : into.bottom;
+	into.px += from.px;
+	into.py += from.py;
+	into.pxx += from.pxx;
+	into.pyy += from.pyy;
+	into.pxy += from.pxy;
+}
+
+// Union-find over provisional blob labels, each holding the sums of its pixels. Labels
+// are numbered in the order they are added, the scratch space is reused once cleared
+class BlobSets {
+public:
+	void clear()
+	{
+		_parent.clear();
+		_stats.clear();
+	}
+
+	uint32_t size() const { return (uint32_t)_parent.size(); }
+	uint32_t capacity() const { return (uint32_t)_parent.capacity(); }
+	void reserve(uint32_t labels)
+	{
+		_parent.reserve(labels);
+		_stats.reserve(labels);
+	}
+	bool root(uint32_t label) const { return _parent[label] == label; }
+	BlobStats &stats(uint32_t label) { return _stats[label]; }
+
+	uint32_t add(int first, int x, int y)
+	{
+		BlobStats stats = { 0, 0, 0, 0, 0, first, x, y, x, y, 0, 0, 0, 0, 0 };
+		_parent.push_back((uint32_t)_stats.size());
+		_stats.push_back(stats);
+		return (uint32_t)_stats.size() - 1;
+	}
+
+	uint32_t find(uint32_t label)
+	{
+		while (_parent[label] != label) {
+			_parent[label] = _parent[_parent[label]];
+			label = _parent[label];
+		}
+		return label;
+	}
+
+	// Joins the blobs of two labels under the older one, which holds the first pixel
+	uint32_t merge(uint32_t a, uint32_t b)
+	{
+		a = find(a);
+		b = find(b);
+		if (a == b)
+			return a;
+		if (b < a) {
+			uint32_t t = a;
+			a = b;
+			b = t;
+		}
+		add_stats(_stats[a], _stats[b]);
+		_parent[b] = a;
+		return a;
+	}
+
+private:
+	std::vector<uint32_t> _parent;
+	std::vector<BlobStats> _stats;
+};
+
+// Thresholds, labels and sums a frame in a single row-major sweep. Each row is masked
+// and labeled against the row above while its color bytes are still in L1, so every
+// byte of the frame is read once. Connected pixels (4-connected) are joined with a
+// union-find over provisional labels whose sums merge along with them. Only two rows of
+// labels are kept, the scratch space is reused from frame to frame.
+// SCAN_RUNS labels runs of set pixels rather than pixels: each row is cut into runs, which
+// join the runs they overlap in the row above, so the union-find costs follow the number
+// of runs. Pixel sums are closed-form over a run, and keeping a blob copies its runs back
+// rather than flood filling it. Suits masks that are mostly clear; the blobs are the same
+enum ScanMode {
+	SCAN_PIXELS,
+	SCAN_RUNS
+};
+
+class BlobScanner {
+public:
+	BlobScanner(ScanMode mode = SCAN_PIXELS) : _mode(mode)
+	{
+		Window none = { 0, 0, -1, -1 };
+		_scanned = none;
+	}
+
+	// Mask of the last scan. Pixels outside its window are clear
+	BitMask &mask() { return _mask; }
+	const BitMask &mask() const { return _mask; }
+
+	// Blobs of the last scan, in the order of their first pixel
+	const std::vector<BlobStats> &blobs() const { return _blobs; }
+
+	// Pixels the last scan covered: the window it was given, widened to whole mask words
+	const Window &scanned() const { return _scanned; }
+
+	ScanMode mode() const { return _mode; }
+	void set_mode(ScanMode mode) { _mode = mode; }
+
+	// Set pixels left to right of a row, and the provisional label they got
+	struct Run {
+		int left, right;
+		uint32_t label;
+	};
+
+	// Runs of the last scan in SCAN_RUNS mode, row by row: those of row y are runs()[i]
+	// for row_begin(y) <= i < row_end(y)
+	const std::vector<Run> &runs() const { return _runs; }
+	size_t row_begin(int y) const { return _row_runs[y - _scanned.top]; }
+	size_t row_end(int y) const { return y < _scanned.bottom ? _row_runs[y + 1 - _scanned.top] : _runs.size(); }
+
+	// Index in blobs() of the blob a run belongs to
+	int blob_of(const Run &run) { return _blob_index[_sets.find(run.label)]; }
+
+	// Provisional labels of the last scan
+	uint32_t labels() const { return _sets.size(); }
+
+	// Makes room for scans of up to that many runs and labels, so they do not allocate.
+	// Grows twice as large as asked, so a slowly rising count is not chased every frame
+	void reserve(size_t runs, uint32_t labels)
+	{
+		if (_runs.capacity() < runs)
+			_runs.reserve(2 * runs);
+		if (_sets.capacity() < labels)
+			_sets.reserve(2 * labels);
+	}
+
+	// Scans the whole frame, or only the pixels of window when given, so the cost follows
+	// the window's size rather than the frame's
+	void scan(const FrameView &frame, const Point3 *vertices, const Segmentation *segmentation = NULL,
+		const Window *window = NULL)
+	{
+		int W = frame.width, H = frame.height;
+		if (W != _mask.width() || H != _mask.height()) {
+			_mask.resize(W, H);
+			_mask.clear();
+			_scanned.bottom = -1;
+		}
+		_labels[0].resize(W);
+		_labels[1].resize(W);
+		_sets.clear();
+		_runs.clear();
+		_row_runs.clear();
+
+		// Only the last window can hold bits
+		clear(_mask, _scanned);
+		Window full = { 0, 0, W - 1, H - 1 };
+		_scanned = full;
+		if (window) {
+			_scanned.left = window->left > 0 ? window->left & ~63 : 0;
+			_scanned.top = window->top > 0 ? window->top : 0;
+			_scanned.right = (window->right | 63) < W - 1 ? window->right | 63 : W - 1;
+			_scanned.bottom = window->bottom < H - 1 ? window->bottom : H - 1;
+		}
+		int first_word = _scanned.left / 64, last_word = _scanned.right / 64;
+
+		for (int y = _scanned.top; y <= _scanned.bottom; y++) {
+			uint64_t *bits = _mask.row(y);
+			mask_row(frame, y, segmentation, bits, _scanned.left, _scanned.right + 1 - _scanned.left);
+			if (_mode == SCAN_RUNS) {
+				label_runs(frame, vertices, y, bits, first_word, last_word);
+				continue;
+			}
+			const uint64_t *above = y > _scanned.top ? _mask.row(y - 1) : NULL;
+			uint32_t *labels = &_labels[y & 1][0], *up = &_labels[(y + 1) & 1][0];
+
+			for (int w = first_word; w <= last_word; w++) {
+				// Pixels whose left and top neighbors are set
+				uint64_t left = (bits[w] << 1) | (w > first_word ? bits[w - 1] >> 63 : 0);
+				uint64_t top = above ? above[w] : 0;
+				for (uint64_t word = bits[w]; word; word &= word - 1) {
+					int i = lowest_bit(word), x = 64 * w + i;
+					uint32_t label;
+					if ((left >> i) & 1) {
+						label = _sets.find(labels[x - 1]);
+						if ((top >> i) & 1)
+							label = _sets.merge(label, up[x]);
+					}
+					else if ((top >> i) & 1)
+						label = _sets.find(up[x]);
+					else
+						label = _sets.add(x + y * W, x, y);
+					labels[x] = label;
+					accumulate(_sets.stats(label), frame, vertices, x, y);
+				}
+			}
+		}
+
+		// Room for as many labels as the union-find holds, so these only grow when it does
+		if (_blob_index.capacity() < _sets.capacity()) {
+			_blob_index.reserve(_sets.capacity());
+			_blobs.reserve(_sets.capacity());
+		}
+		_blobs.clear();
+		_blob_index.resize(_sets.size());
+		bool depth_sums = sums_depth(frame, vertices);
+		for (uint32_t i = 0; i < _sets.size(); i++) {
+			if (_sets.root(i)) {
+				_blob_index[i] = (int)_blobs.size();
+				_blobs.push_back(_sets.stats(i));
+				if (depth_sums)
+					deproject_sums(_blobs.back(), frame.intrin);
+			}
+		}
+	}
+
+	// Clears every pixel of the mask but those of blob
+	void keep(const BlobStats &blob)
+	{
+		if (_mode == SCAN_RUNS) {
+			keep_runs(blob);
+			return;
+		}
+		int W = _mask.width();
+		Window box = { blob.left, blob.top, blob.right, blob.bottom };
+		_kept.resize(W, _mask.height());
+		clear(_kept, box);
+		_stack.clear();
+		_stack.push_back(blob.first);
+		_kept.set(blob.first % W, blob.first / W);
+		while (!_stack.empty()) {
+			int p = _stack.back();
+			_stack.pop_back();
+			int x = p % W, y = p / W;
+			if (y + 1 <= blob.bottom && _mask.get(x, y + 1) && !_kept.get(x, y + 1)) {
+				_kept.set(x, y + 1);
+				_stack.push_back(p + W);
+			}
+			if (x - 1 >= blob.left && _mask.get(x - 1, y) && !_kept.get(x - 1, y)) {
+				_kept.set(x - 1, y);
+				_stack.push_back(p - 1);
+			}
+			if (y - 1 >= blob.top && _mask.get(x, y - 1) && !_kept.get(x, y - 1)) {
+				_kept.set(x, y - 1);
+				_stack.push_back(p - W);
+			}
+			if (x + 1 <= blob.right && _mask.get(x + 1, y) && !_kept.get(x + 1, y)) {
+				_kept.set(x + 1, y);
+				_stack.push_back(p + 1);
+			}
+		}
+
+		clear(_mask, _scanned);
+		for (int y = box.top; y <= box.bottom; y++)
+			for (int w = box.left / 64; w <= box.right / 64; w++)
+				_mask.row(y)[w] = _kept.row(y)[w];
+	}
+
+private:
+	// Clears the words of mask under window
+	static void clear(BitMask &mask, const Window &window)
+	{
+		for (int y = window.top; y <= window.bottom; y++)
+			for (int w = window.left / 64; w <= window.right / 64; w++)
+				mask.row(y)[w] = 0;
+	}
+
+	// Cuts row y into runs and labels each from the runs of the row above it overlaps
+	void label_runs(const FrameView &frame, const Point3 *vertices, int y, const uint64_t *bits,
+		int first_word, int last_word)
+	{
+		size_t above = _row_runs.empty() ? _runs.size() : _row_runs.back(), end_above = _runs.size();
+		_row_runs.push_back(_runs.size());
+
+		for (int w = first_word; w <= last_word; w++) {
+			uint64_t word = bits[w];
+			while (word) {
+				// The lowest set bit and every bit below it, so the first clear bit above
+				// ends the run unless the run goes on into the next words
+				int left = 64 * w + lowest_bit(word), right;
+				uint64_t filled = word | (word - 1);
+				if (~filled) {
+					int end = lowest_bit(~filled);
+					right = 64 * w + end - 1;
+					word &= ~(((uint64_t)1 << end) - 1);
+				}
+				else {
+					while (w < last_word && bits[w + 1] == ~(uint64_t)0)
+						w++;
+					if (w == last_word) {
+						right = 64 * w + 63;
+						word = 0;
+					}
+					else {
+						w++;
+						int end = lowest_bit(~bits[w]);
+						right = 64 * w + end - 1;
+						word = bits[w] & ~(((uint64_t)1 << end) - 1);
+					}
+				}
+				if (right >= frame.width)
+					right = frame.width - 1;
+
+				// Runs above that end left of this one cannot touch the next ones either
+				while (above < end_above && _runs[above].right < left)
+					above++;
+				uint32_t label = (uint32_t)-1;
+				for (size_t a = above; a < end_above && _runs[a].left <= right; a++)
+					label = label == (uint32_t)-1 ? _sets.find(_runs[a].label) : _sets.merge(label, _runs[a].label);
+				if (label == (uint32_t)-1)
+					label = _sets.add(left + y * frame.width, left, y);
+
+				BlobStats &stats = _sets.stats(label);
+				int length = right - left + 1;
+				stats.size += length;
+				if (left < stats.left)
+					stats.left = left;
+				if (right > stats.right)
+					stats.right = right;
+				stats.bottom = y;
+				// Arithmetic series over the run, and the sum of squares as the difference of
+				// n (n + 1) (2 n + 1) / 6 at both ends
+				long long sum = (long long)(left + right) * length / 2;
+				long long squares = (long long)right * (right + 1) * (2 * right + 1) / 6 -
+					(long long)(left - 1) * left * (2 * left - 1) / 6;
+				stats.px += (double)sum;
+				stats.py += (double)y * length;
+				stats.pxx += (double)squares;
+				stats.pyy += (double)y * y * length;
+				stats.pxy += (double)y * sum;
+				if (sums_depth(frame, vertices))
+					add_depth(stats, frame, left, right, y);
+				else
+					for (int x = left; x <= right; x++)
+						add_vertex(stats, vertex_at(frame, vertices, x, y));
+				Run run = { left, right, label };
+				_runs.push_back(run);
+			}
+		}
+	}
+
+	// Writes the runs of blob back into a cleared mask. Its first pixel starts its first
+	// run, which tells its label
+	void keep_runs(const BlobStats &blob)
+	{
+		int W = _mask.width();
+		uint32_t root = (uint32_t)-1;
+		for (size_t r = row_begin(blob.top); r < row_end(blob.top) && root == (uint32_t)-1; r++)
+			if (_runs[r].left == blob.first % W)
+				root = _sets.find(_runs[r].label);
+
+		clear(_mask, _scanned);
+		for (int y = blob.top; y <= blob.bottom; y++) {
+			uint64_t *bits = _mask.row(y);
+			for (size_t r = row_begin(y); r < row_end(y); r++) {
+				const Run &run = _runs[r];
+				if (_sets.find(run.label) != root)
+					continue;
+				for (int w = run.left / 64; w <= run.right / 64; w++) {
+					int from = w == run.left / 64 ? run.left % 64 : 0, to = w == run.right / 64 ? run.right % 64 : 63;
+					uint64_t ones = to - from == 63 ? ~(uint64_t)0 : (((uint64_t)1 << (to - from + 1)) - 1) << from;
+					bits[w] |= ones;
+				}
+			}
+		}
+	}
+
+	BitMask _mask, _kept;
+	Window _scanned;
+	std::vector<uint32_t> _labels[2];
+	BlobSets _sets;
+	ScanMode _mode;
+	std::vector<Run> _runs;          // runs of every scanned row, in raster order
+	std::vector<size_t> _row_runs;   // first run of every scanned row
+	std::vector<BlobStats> _blobs;
+	std::vector<int> _blob_index;    // blob of every root label
+	std::vector<int> _stack;
+};
+
+// The first of the largest blobs, in raster order. NULL when there is none
+inline const BlobStats *largest_blob(const std::vector<BlobStats> &blobs)
+{
+	const BlobStats *largest = NULL;
+	for (size_t i = 0; i < blobs.size(); i++)
+		if (!largest || largest->size < blobs[i].size)
+			largest = &blobs[i];
+	return largest;
+}
+
+// Whether blob reaches an edge of window that is not an edge of the frame, so it may
+// extend past the window
+inline bool blob_touches(const BlobStats &blob, const Window &window, const FrameView &frame)
+{
+	return (blob.left <= window.left && window.left > 0) || (blob.top <= window.top && window.top > 0) ||
+		(blob.right >= window.right && window.right < frame.width - 1) ||
+		(blob.bottom >= window.bottom && window.bottom < frame.height - 1);
+}
+
+// Fills result with the size of blob and the average of its vertices, zeros when there is
+// no blob. result.blobs is left to the caller
+inline void fill_result(const BlobStats *blob, Localization &result)
+{
+	result.size = blob ? blob->size : 0;
+	result.count = blob ? blob->count : 0;
+	result.x = result.count == 0 ? 0 : (float)(blob->x / result.count);
+	result.y = result.count == 0 ? 0 : (float)(blob->y / result.count);
+	result.z = result.count == 0 ? 0 : (float)(blob->z / result.count);
+}
+
+// Averages the vertices of the largest blob of the last scan into result, from its sums
+// alone: one look at every blob and none at any pixel. Returns that blob, NULL when there
+// is none. The mask is left as scanned, keep() the blob to clear the others
+inline const BlobStats *localize_largest(BlobScanner &scanner, Localization &result)
+{
+	const std::vector<BlobStats> &blobs = scanner.blobs();
+	const BlobStats *largest = largest_blob(blobs);
+
+	result.blobs = (int)blobs.size();
+	fill_result(largest, result);
+	return largest;
+}
+
+// Masks the frame, separates the mask into blobs and averages the vertices of the
+// largest one, which it returns. Without vertices, each blob's depth sums are deprojected
+inline const BlobStats *localize_frame(const FrameView &frame, BlobScanner &scanner, const Point3 *vertices,
+	Localization &result, const Segmentation *segmentation = NULL)
+{
+	scanner.scan(frame, vertices, segmentation);
+	return localize_largest(scanner, result);
+}
@@ -0,0 +1,149 @@
+// Localizes every frame of a recording on all cores and writes one result per frame, in
+// recording order.
+//
+//   localize_batch <recording> <output> [--threads <n>] [--start <frame>] [--frames <n>]
+//
+// An output ending in .csv is written as text, anything else as a BatchHeader followed
+// by one BatchRecord per frame. Builds on any platform:
+//   g++ -O2 -std=c++11 -pthread localize_batch.cpp -o localize_batch
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "localize.hpp"
+#include "recording.hpp"
+
+const uint32_t BATCH_MAGIC = 0x42534C52; // "RLSB"
+const uint32_t BATCH_VERSION = 1;
+
+struct BatchHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t frame_count;
+};
+
+struct BatchRecord {
+	uint64_t number;   // camera frame number
+	double timestamp;  // milliseconds
+	float x, y, z;     // centroid in meters, 0 when count is 0
+	int32_t count;     // pixels of the blob with depth data
+	int32_t size;      // pixels of the blob
+	int32_t blobs;
+};
+
+// Frames localized between two writes. Keeps the output streaming and the memory bounded
+// however long the recording is
+const uint64_t BATCH_FRAMES = 4096;
+
+int main(int argc, char * argv[]) try
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <recording> <output> [--threads <n>] [--start <frame>] [--frames <n>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *input = argv[1], *output = argv[2];
+	int threads = (int)std::thread::hardware_concurrency();
+	uint64_t start_frame = 0, frames = (uint64_t)-1;
+	for (int i = 3; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--start") && i + 1 < argc)
+			start_frame = strtoull(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (threads < 1)
+		threads = 1;
+
+	Recording recording(input);
+	uint64_t end_frame = start_frame + frames < start_frame || start_frame + frames > recording.size() ?
+		recording.size() : start_frame + frames;
+	if (start_frame > end_frame)
+		start_frame = end_frame;
+
+	size_t length = strlen(output);
+	bool csv = length > 4 && !strcmp(output + length - 4, ".csv");
+	FILE *out = fopen(output, csv ? "w" : "wb");
+	if (!out) {
+		fprintf(stderr, "Cannot create %s\n", output);
+		return EXIT_FAILURE;
+	}
+	if (csv)
+		fprintf(out, "number,timestamp,x,y,z,count,size,blobs\n");
+	else {
+		BatchHeader header = { BATCH_MAGIC, BATCH_VERSION, end_frame - start_frame };
+		fwrite(&header, sizeof(header), 1, out);
+	}
+
+	std::vector<BlobScanner> scanners(threads);
+	std::vector<BatchRecord> records(BATCH_FRAMES);
+
+	auto started = std::chrono::steady_clock::now();
+	for (uint64_t first = start_frame; first < end_frame; first += BATCH_FRAMES) {
+		uint64_t count = end_frame - first < BATCH_FRAMES ? end_frame - first : BATCH_FRAMES;
+
+		// Workers take the next frame as they finish one, so slow frames even out
+		std::atomic<uint64_t> next(0);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(std::thread([&, t] {
+				BlobScanner &scanner = scanners[t];
+				for (uint64_t i; (i = next++) < count; ) {
+					FrameView frame;
+					recording.frame(first + i, frame);
+					Localization result;
+					localize_frame(frame, scanner, NULL, result);
+					BatchRecord &record = records[i];
+					record.number = frame.number;
+					record.timestamp = frame.timestamp;
+					record.x = result.x;
+					record.y = result.y;
+					record.z = result.z;
+					record.count = result.count;
+					record.size = result.size;
+					record.blobs = result.blobs;
+				}
+			}));
+		}
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+		if (csv) {
+			for (uint64_t i = 0; i < count; i++) {
+				const BatchRecord &r = records[i];
+				fprintf(out, "%llu,%.3f,%f,%f,%f,%d,%d,%d\n", (unsigned long long)r.number, r.timestamp,
+					r.x, r.y, r.z, r.count, r.size, r.blobs);
+			}
+		}
+		else
+			fwrite(&records[0], sizeof(BatchRecord), count, out);
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+		uint64_t done = first + count - start_frame;
+		fprintf(stderr, "\r%llu / %llu frames, %.1f frames/sec", (unsigned long long)done,
+			(unsigned long long)(end_frame - start_frame), elapsed.count() > 0 ? done / elapsed.count() : 0.0);
+	}
+	fprintf(stderr, "\n");
+
+	if (fclose(out)) {
+		fprintf(stderr, "Cannot write %s\n", output);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+catch (const std::exception & e)
+{
+	std::cerr << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
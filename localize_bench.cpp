@@ -0,0 +1,256 @@
+// Measures the throughput and accuracy of the localization path on generated scenes
+// with known target positions. Every frame is localized twice: from a full point cloud,
+// and from the depth plane alone, summing depth per blob and deprojecting only the sums
+// ("sparse ms"), which the rates refer to. It is then tracked searching only a window
+// around its predicted position ("roi ms"), and localized coarse to fine from a frame
+// sampled down by 4 ("coarse ms"), which must find the same blob, labeling runs rather
+// than pixels ("runs ms"), and labeling strips of the frame on --threads cores, every
+// core by default ("strips ms"). The vector color mask kernels are first checked against
+// the scalar one.
+//
+//   localize_bench [--res <w>x<h>]... [--frames <n>] [--targets <n>] [--distractors <n>]
+//                  [--noise <sigma>] [--depth-noise <meters>] [--holes <fraction>]
+//                  [--seed <n>] [--truth <csv>] [--threads <n>]
+//
+// Defaults to 640x480, 1280x720 and 3840x2160. --truth writes the ground truth of every
+// generated frame. Builds on any platform:
+//   g++ -O2 -std=c++11 -pthread localize_bench.cpp -o localize_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "blob_tracker.hpp"
+#include "coarse_locator.hpp"
+#include "frame_source.hpp"
+#include "localize.hpp"
+#include "strip_scanner.hpp"
+#include "synthetic_scene.hpp"
+
+struct Resolution {
+	int width, height;
+};
+
+// Whether two localizations found the same blob at the same place
+static bool same_blob(const Localization &a, const Localization &b)
+{
+	return a.size == b.size && a.count == b.count && a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+int main(int argc, char * argv[]) try
+{
+	std::vector<Resolution> resolutions;
+	SceneConfig config = default_scene(0, 0);
+	int frames = 100;
+	const char *truth = NULL;
+	int threads = 0;
+
+	for (int i = 1; i < argc; i++) {
+		Resolution res;
+		if (!strcmp(argv[i], "--res") && i + 1 < argc && sscanf(argv[++i], "%dx%d", &res.width, &res.height) == 2)
+			resolutions.push_back(res);
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+			if (frames < 1) {
+				fprintf(stderr, "--frames takes at least 1 frame\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "--targets") && i + 1 < argc)
+			config.targets = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--distractors") && i + 1 < argc)
+			config.distractors = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--noise") && i + 1 < argc)
+			config.color_noise = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--depth-noise") && i + 1 < argc)
+			config.depth_noise = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--holes") && i + 1 < argc)
+			config.holes = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			config.seed = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--truth") && i + 1 < argc)
+			truth = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--res <w>x<h>]... [--frames <n>] [--targets <n>] [--distractors <n>] "
+				"[--noise <sigma>] [--depth-noise <meters>] [--holes <fraction>] [--seed <n>] [--truth <csv>] [--threads <n>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (resolutions.empty()) {
+		Resolution defaults[] = { { 640, 480 }, { 1280, 720 }, { 3840, 2160 } };
+		resolutions.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+	}
+
+	FILE *truth_file = NULL;
+	if (truth) {
+		truth_file = fopen(truth, "w");
+		if (!truth_file) {
+			fprintf(stderr, "Cannot create %s\n", truth);
+			return EXIT_FAILURE;
+		}
+		fprintf(truth_file, "width,height,frame,object,target,x,y,z,radius,pixels\n");
+	}
+
+	// Every vector kernel the CPU runs must mask exactly like the scalar one
+	ColorMaskIsa isa = color_mask_best_isa();
+	{
+		SceneGenerator scene(default_scene(640, 480));
+		std::vector<uint16_t> depth(640 * 480);
+		std::vector<uint8_t> color(640 * 480 * 3);
+		std::vector<SceneObject> objects;
+		scene.render(0, &depth[0], &color[0], objects);
+		ChromaTarget chroma = chroma_target(TARGET, 30, 20, 235);
+		// The inverted band passes no depth, not even the target's at its max
+		uint16_t target_depth = (uint16_t)(objects[0].z / scene.intrinsics().depth_scale + 0.5f);
+		DepthBand bands[] = { { 500, 1500 }, { 60000, target_depth } };
+		// Row widths that are not a whole number of words take the scalar tail
+		int widths[] = { 640, 600, 63 };
+		for (int k = 0; k < 6; k++) {
+			const DepthBand &band = bands[k / 3];
+			int w = k % 3;
+			int words = (widths[w] + 63) / 64;
+			std::vector<uint64_t> expected(words * 480), expected_chroma(words * 480), expected_depth(words * 480), mask(words * 480);
+			for (int y = 0; y < 480; y++) {
+				color_mask_scalar(&color[3 * 640 * y], widths[w], TARGET, &expected[words * y]);
+				chroma_mask_scalar(&color[3 * 640 * y], widths[w], chroma, &expected_chroma[words * y]);
+				chroma_mask_scalar(&color[3 * 640 * y], widths[w], chroma, &expected_depth[words * y]);
+				depth_band_scalar(&depth[640 * y], widths[w], band, &expected_depth[words * y]);
+			}
+			for (int i = COLOR_MASK_SSE41; i <= isa; i++) {
+				for (int y = 0; y < 480; y++)
+					color_mask_kernel((ColorMaskIsa)i, TARGET)(&color[3 * 640 * y], widths[w], TARGET, &mask[words * y]);
+				bool same = mask == expected;
+				for (int y = 0; y < 480; y++)
+					chroma_mask_kernel((ColorMaskIsa)i, chroma)(&color[3 * 640 * y], widths[w], chroma, &mask[words * y]);
+				same = same && mask == expected_chroma;
+				for (int y = 0; y < 480; y++)
+					depth_band_kernel((ColorMaskIsa)i)(&depth[640 * y], widths[w], band, &mask[words * y]);
+				if (!same || mask != expected_depth) {
+					fprintf(stderr, "The %s color mask differs from the scalar one\n", color_mask_isa_name((ColorMaskIsa)i));
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+	printf("color mask kernel: %s\n", color_mask_isa_name(isa));
+
+	printf("%-10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "res", "mask ms", "points ms", "locate ms", "sparse ms", "frames/s", "roi ms", "coarse ms", "runs ms", "strips ms", "found", "err mm");
+	for (size_t r = 0; r < resolutions.size(); r++) {
+		config.width = resolutions[r].width;
+		config.height = resolutions[r].height;
+		int pixels = config.width * config.height;
+
+		// Generating is slower than localizing, so render a few frames up front and cycle
+		// through them
+		SceneGenerator scene(config);
+		int rendered = frames < 16 ? frames : 16;
+		std::vector<std::vector<uint16_t> > depth(rendered, std::vector<uint16_t>(pixels));
+		std::vector<std::vector<uint8_t> > color(rendered, std::vector<uint8_t>(pixels * 3));
+		std::vector<std::vector<SceneObject> > objects(rendered);
+		for (int n = 0; n < rendered; n++) {
+			scene.render(n, &depth[n][0], &color[n][0], objects[n]);
+			for (size_t o = 0; truth_file && o < objects[n].size(); o++) {
+				const SceneObject &obj = objects[n][o];
+				fprintf(truth_file, "%d,%d,%d,%d,%d,%f,%f,%f,%f,%d\n", config.width, config.height, n, (int)o,
+					obj.target ? 1 : 0, obj.x, obj.y, obj.z, obj.radius, obj.pixels);
+			}
+		}
+
+		BitMask mask(config.width, config.height);
+		BlobScanner scanner, roi_scanner, coarse_scanner, run_scanner(SCAN_RUNS);
+		BlobTracker tracker;
+		CoarseLocator coarse;
+		StripScanner strips(threads);
+		std::vector<Point3> vertices(pixels);
+		std::chrono::duration<double> mask_time(0), points_time(0), locate_time(0), sparse_time(0), roi_time(0), coarse_time(0), runs_time(0), strips_time(0);
+		int found = 0, roi_mismatches = 0, coarse_mismatches = 0, run_mismatches = 0, strip_mismatches = 0;
+		double error = 0;
+
+		for (int n = 0; n < frames; n++) {
+			FrameView frame;
+			frame.depth = &depth[n % rendered][0];
+			frame.color = &color[n % rendered][0];
+			frame.width = config.width;
+			frame.height = config.height;
+			frame.intrin = scene.intrinsics();
+			frame.timestamp = n * (1000.0 / 30);
+			frame.number = n;
+
+			auto masking = std::chrono::steady_clock::now();
+			build_mask(frame, mask);
+			auto start = std::chrono::steady_clock::now();
+			mask_time += start - masking;
+			calculate_points(frame, &vertices[0]);
+			auto located = std::chrono::steady_clock::now();
+			Localization result;
+			localize_frame(frame, scanner, &vertices[0], result);
+			auto dense_end = std::chrono::steady_clock::now();
+			localize_frame(frame, scanner, NULL, result);
+			auto end = std::chrono::steady_clock::now();
+			Localization tracked;
+			tracker.localize(frame, roi_scanner, NULL, tracked);
+			auto roi_end = std::chrono::steady_clock::now();
+			Localization refined;
+			coarse.localize(frame, coarse_scanner, NULL, refined);
+			auto coarse_end = std::chrono::steady_clock::now();
+			Localization runs;
+			localize_frame(frame, run_scanner, NULL, runs);
+			auto runs_end = std::chrono::steady_clock::now();
+			Localization parallel;
+			strips.localize(frame, NULL, parallel);
+			auto strips_end = std::chrono::steady_clock::now();
+			// Every path must find the blob of the full scan. Strips sum their parts in
+			// another order, so only their counts are compared exactly
+			roi_mismatches += !same_blob(tracked, result);
+			coarse_mismatches += !same_blob(refined, result);
+			run_mismatches += !same_blob(runs, result) || runs.blobs != result.blobs;
+			strip_mismatches += parallel.size != result.size || parallel.count != result.count || parallel.blobs != result.blobs;
+			points_time += located - start;
+			locate_time += dense_end - located;
+			sparse_time += end - dense_end;
+			roi_time += roi_end - end;
+			coarse_time += coarse_end - roi_end;
+			runs_time += runs_end - coarse_end;
+			strips_time += strips_end - runs_end;
+
+			// Found when the centroid lies within the largest target's radius
+			const SceneObject *target = largest_target(objects[n % rendered]);
+			if (target && result.count) {
+				float dx = result.x - target->x, dy = result.y - target->y, dz = result.z - target->z;
+				float d = sqrtf(dx * dx + dy * dy + dz * dz);
+				if (d < target->radius) {
+					found++;
+					error += d;
+				}
+			}
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "%dx%d", config.width, config.height);
+		double total = sparse_time.count();
+		printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.1f %10.3f %10.3f %10.3f %10.3f %9.1f%% %10.2f\n", name,
+			mask_time.count() * 1000 / frames, points_time.count() * 1000 / frames, locate_time.count() * 1000 / frames,
+			sparse_time.count() * 1000 / frames, total > 0 ? frames / total : 0.0, roi_time.count() * 1000 / frames,
+			coarse_time.count() * 1000 / frames, runs_time.count() * 1000 / frames,
+			strips_time.count() * 1000 / frames, 100.0 * found / frames, found ? error * 1000 / found : 0.0);
+		if (roi_mismatches || coarse_mismatches || run_mismatches || strip_mismatches)
+			fprintf(stderr, "Differed from the full scan: roi %d, coarse %d, runs %d, strips %d times\n",
+				roi_mismatches, coarse_mismatches, run_mismatches, strip_mismatches);
+	}
+
+	if (truth_file)
+		fclose(truth_file);
+	return EXIT_SUCCESS;
+}
+catch (const std::exception & e)
+{
+	std::cerr << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,341 @@
+// Runs the rs-pointcloud localization loop without a camera or a window, as fast as
+// the CPU allows, and reports the frame rate.
+//
+//   localize_headless [--replay <file> [--start <frame>]] [--record <file>]
+//                     [--frames <n>] [--width <w>] [--height <h>] [--threaded] [--dense] [--runs]
+//                     [--strips <threads>]
+//                     [--lut <bits>] [--chroma <distance>] [--class <r>,<g>,<b>,<distance>]...
+//                     [--roi <padding>] [--coarse <factor>] [--adapt <rate>] [--depth <min>,<max>]
+//                     [--top <k>,<key>] [--area <min>,<max>] [--quiet]
+//
+// Without --replay it runs on a synthetic scene. --record saves every frame read as a
+// recording, skipped ones included. --threaded reads frames on a capture thread, processing
+// only the newest one as rs-pointcloud does. --dense deprojects every pixel up front rather
+// than summing depth per blob and deprojecting the sums. --runs labels runs of mask pixels
+// rather than pixels. --strips labels horizontal strips of the frame on that many threads
+// (0 for every core). --lut classifies colors with a lookup table of the target color,
+// quantized to bits per channel. --chroma matches the target color's chroma within
+// distance instead, whatever its brightness. Each --class adds a target color, all of
+// them are labeled in one pass, through a table of --lut bits (5 by default), and
+// localized separately; --chroma, --adapt, --roi, --coarse, --strips, --depth and --runs
+// do not apply to them. --roi only searches around where the target is expected, padding
+// its predicted bounding box by that many pixels, and falls back to the whole frame when
+// it is lost. --coarse finds candidate blobs in a frame sampled down by factor (4 or 8)
+// and only labels those at full resolution. --adapt learns the target's chroma from the
+// blob found in every frame, in a table of --lut bits, starting from the --chroma distance
+// (30 by default) around the target color, and blending each frame in at rate. --depth
+// drops pixels whose depth is outside min to max, in depth units (millimeters on a D400),
+// before they are labeled. --top lists the k best blobs of every frame by key: area,
+// metric (area in square meters), depth (nearest first) or compact. --area only lists
+// blobs of min to max pixels. Builds on any platform:
+//   g++ -O2 -std=c++11 -pthread localize_headless.cpp -o localize_headless
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "adaptive_color.hpp"
+#include "blob_query.hpp"
+#include "blob_tracker.hpp"
+#include "coarse_locator.hpp"
+#include "frame_arena.hpp"
+#include "frame_buffer.hpp"
+#include "frame_source.hpp"
+#include "label_image.hpp"
+#include "localize.hpp"
+#include "recording.hpp"
+#include "strip_scanner.hpp"
+#include "synthetic_scene.hpp"
+
+// Counts every operator new of the process, to check that the steady-state loop makes no
+// heap allocation. Every form of new and delete goes through the same pair of functions
+static std::atomic<unsigned long long> heap_allocations(0);
+
+static void *counted_allocate(size_t size)
+{
+	heap_allocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+static void counted_release(void *p)
+{
+	free(p);
+}
+
+void *operator new(size_t size) { return counted_allocate(size); }
+void *operator new[](size_t size) { return counted_allocate(size); }
+void operator delete(void *p) noexcept { counted_release(p); }
+void operator delete[](void *p) noexcept { counted_release(p); }
+void operator delete(void *p, size_t) noexcept { counted_release(p); }
+void operator delete[](void *p, size_t) noexcept { counted_release(p); }
+
+// Frames after which the loop should stop allocating: scratch space has grown to fit
+const unsigned long long WARM_UP_FRAMES = 10;
+
+int main(int argc, char * argv[]) try
+{
+	const char *replay = NULL, *record = NULL;
+	long long start_frame = -1;
+	unsigned long long frames = 300;
+	int width = 640, height = 480;
+	bool threaded = false, dense = false, runs = false, quiet = false;
+	int lut_bits = 0, chroma = -1, roi = -1, coarse = 0, strips = -1;
+	float adapt = 0;
+	DepthBand band = { 0, 0 };
+	bool depth_gate = false;
+	std::vector<ColorTarget> classes;
+	BlobQuery query;
+	bool top = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+			replay = argv[++i];
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+			record = argv[++i];
+		else if (!strcmp(argv[i], "--start") && i + 1 < argc)
+			start_frame = strtoll(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "--width") && i + 1 < argc)
+			width = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--height") && i + 1 < argc)
+			height = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threaded"))
+			threaded = true;
+		else if (!strcmp(argv[i], "--dense"))
+			dense = true;
+		else if (!strcmp(argv[i], "--runs"))
+			runs = true;
+		else if (!strcmp(argv[i], "--strips") && i + 1 < argc)
+			strips = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--lut") && i + 1 < argc) {
+			lut_bits = atoi(argv[++i]);
+			if (lut_bits < 1 || lut_bits > 8) {
+				fprintf(stderr, "--lut takes 1 to 8 bits\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "--chroma") && i + 1 < argc)
+			chroma = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--roi") && i + 1 < argc)
+			roi = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--coarse") && i + 1 < argc) {
+			coarse = atoi(argv[++i]);
+			if (coarse != 4 && coarse != 8) {
+				fprintf(stderr, "--coarse takes a factor of 4 or 8\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "--adapt") && i + 1 < argc)
+			adapt = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+			int low, high;
+			if (sscanf(argv[++i], "%i,%i", &low, &high) != 2 || low < 0 || high < low || high > 65535) {
+				fprintf(stderr, "--depth takes <min>,<max>\n");
+				return EXIT_FAILURE;
+			}
+			band.min = (uint16_t)low;
+			band.max = (uint16_t)high;
+			depth_gate = true;
+		}
+		else if (!strcmp(argv[i], "--class") && i + 1 < argc) {
+			int r, g, b, distance;
+			if (sscanf(argv[++i], "%i,%i,%i,%i", &r, &g, &b, &distance) != 4) {
+				fprintf(stderr, "--class takes <r>,<g>,<b>,<distance>\n");
+				return EXIT_FAILURE;
+			}
+			ColorTarget target = { (uint8_t)r, (uint8_t)g, (uint8_t)b, distance };
+			classes.push_back(target);
+		}
+		else if (!strcmp(argv[i], "--top") && i + 1 < argc) {
+			char key[16];
+			if (sscanf(argv[++i], "%i,%15s", &query.k, key) != 2 || query.k < 1) {
+				fprintf(stderr, "--top takes <k>,<area|metric|depth|compact>\n");
+				return EXIT_FAILURE;
+			}
+			if (!strcmp(key, "area"))
+				query.key = BLOB_AREA;
+			else if (!strcmp(key, "metric"))
+				query.key = BLOB_METRIC_AREA;
+			else if (!strcmp(key, "depth")) {
+				query.key = BLOB_DEPTH;
+				query.ascending = true;
+			}
+			else if (!strcmp(key, "compact"))
+				query.key = BLOB_COMPACTNESS;
+			else {
+				fprintf(stderr, "--top takes <k>,<area|metric|depth|compact>\n");
+				return EXIT_FAILURE;
+			}
+			top = true;
+		}
+		else if (!strcmp(argv[i], "--area") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%i,%i", &query.min_area, &query.max_area) != 2 || query.max_area < query.min_area) {
+				fprintf(stderr, "--area takes <min>,<max>\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if (!strcmp(argv[i], "--quiet"))
+			quiet = true;
+		else {
+			fprintf(stderr, "usage: %s [--replay <file> [--start <frame>]] [--record <file>] "
+				"[--frames <n>] [--width <w>] [--height <h>] [--threaded] [--dense] [--runs] [--strips <threads>] [--lut <bits>] [--chroma <distance>] [--class <r>,<g>,<b>,<distance>]... [--roi <padding>] [--coarse <factor>] [--adapt <rate>] [--depth <min>,<max>] [--top <k>,<key>] [--area <min>,<max>] [--quiet]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (top && (roi >= 0 || coarse > 1 || !classes.empty())) {
+		fprintf(stderr, "--top ranks the blobs of the whole frame, which --roi, --coarse and --class do not label\n");
+		return EXIT_FAILURE;
+	}
+	if (!classes.empty() && (chroma >= 0 || adapt > 0 || roi >= 0 || coarse > 1 || strips >= 0 || depth_gate || runs)) {
+		fprintf(stderr, "--chroma, --adapt, --roi, --coarse, --strips, --depth and --runs do not apply to --class\n");
+		return EXIT_FAILURE;
+	}
+	if (lut_bits > 0 && chroma >= 0 && adapt <= 0) {
+		fprintf(stderr, "--lut and --chroma both match the target color, give one of them\n");
+		return EXIT_FAILURE;
+	}
+	if (adapt > 0 && strips >= 0) {
+		fprintf(stderr, "--adapt learns from the mask, which --strips does not keep\n");
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<FrameSource> source;
+	if (replay) {
+		ReplaySource *replay_source = new ReplaySource(replay);
+		source.reset(replay_source);
+		if (start_frame >= 0)
+			replay_source->seek(start_frame);
+	}
+	else
+		source.reset(new SyntheticSource(width, height, frames));
+	// Frames are recorded as they are read, on the capture thread with --threaded
+	std::unique_ptr<RecordingSource> recording;
+	if (record)
+		recording.reset(new RecordingSource(*source, record));
+	FrameSource &read = recording ? (FrameSource &)*recording : *source;
+	std::unique_ptr<CaptureThread> capture;
+	if (threaded)
+		capture.reset(new CaptureThread(read));
+	FrameSource &input = capture ? (FrameSource &)*capture : read;
+
+	std::unique_ptr<ColorClassifier> classifier;
+	if (!classes.empty())
+		classifier.reset(new ColorClassifier(target_classes(classes), lut_bits > 0 ? lut_bits : 5));
+	else if (lut_bits > 0)
+		classifier.reset(new ColorClassifier(target_predicate, lut_bits));
+	ChromaTarget chroma_model = chroma_target(TARGET, chroma);
+	std::unique_ptr<AdaptiveColorModel> adaptive;
+	if (adapt > 0)
+		adaptive.reset(new AdaptiveColorModel(chroma_target(TARGET, chroma >= 0 ? chroma : 30), adapt, -1, 0.005f,
+			lut_bits > 0 ? lut_bits : 5));
+	std::vector<Localization> class_results(classes.size());
+	ComponentLabeler labeler;
+
+	BlobScanner scanner(runs ? SCAN_RUNS : SCAN_PIXELS);
+	BlobTracker tracker(roi);
+	CoarseLocator coarse_locator(coarse > 1 ? coarse : 4);
+	std::unique_ptr<StripScanner> strip_scanner;
+	if (strips >= 0)
+		strip_scanner.reset(new StripScanner(strips));
+	FrameArena arena;  // labels and vertices of the current frame
+	std::vector<RankedBlob> ranked;
+	// Arenas take their blocks from malloc, which the operator new count does not see
+	auto arena_allocations = [&]() {
+		return arena.allocations() + coarse_locator.allocations() + (strip_scanner ? strip_scanner->allocations() : 0);
+	};
+	FrameView frame;
+	unsigned long long processed = 0, warm_allocations = 0, warm_arenas = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	while (input.next(frame))
+	{
+		if (processed == WARM_UP_FRAMES) {
+			warm_allocations = heap_allocations;
+			warm_arenas = arena_allocations();
+		}
+		arena.reset();
+
+		Point3 *vertices = NULL;
+		if (dense) {
+			vertices = arena.allocate<Point3>((size_t)frame.width * frame.height);
+			calculate_points(frame, vertices);
+		}
+
+		if (!classes.empty()) {
+			uint8_t *labels = arena.allocate<uint8_t>((size_t)frame.width * frame.height);
+			build_labels(frame, *classifier->current(), labels);
+			localize_labels(frame, labels, (int)classes.size(), vertices, &class_results[0], labeler, arena);
+			processed++;
+			for (size_t c = 0; !quiet && c < classes.size(); c++)
+				printf("Class %d: Average Of (%d) Stuff: %f, %f, %f\n", (int)c + 1, class_results[c].count,
+					class_results[c].x, class_results[c].y, class_results[c].z);
+			continue;
+		}
+
+		Localization result;
+		Segmentation segmentation = { classifier ? classifier->current().get() : NULL, chroma >= 0 ? &chroma_model : NULL,
+			depth_gate ? &band : NULL };
+		if (adaptive)
+			segmentation.lut = &adaptive->lut();
+		const BlobStats *blob;
+		if (strip_scanner)
+			blob = strip_scanner->localize(frame, vertices, result, &segmentation);
+		else if (coarse > 1)
+			blob = coarse_locator.localize(frame, scanner, vertices, result, &segmentation);
+		else if (roi >= 0)
+			blob = tracker.localize(frame, scanner, vertices, result, &segmentation);
+		else
+			blob = localize_frame(frame, scanner, vertices, result, &segmentation);
+		if (adaptive && blob)
+			scanner.keep(*blob);
+		if (adaptive)
+			adaptive->learn(frame, scanner.mask(), scanner.scanned());
+		processed++;
+
+		if (!quiet)
+			printf("Average Of (%d) Stuff: %f, %f, %f\n", result.count, result.x, result.y, result.z);
+		if (top) {
+			query_blobs(strip_scanner ? strip_scanner->blobs() : scanner.blobs(), frame.intrin, query, ranked);
+			for (size_t b = 0; !quiet && b < ranked.size(); b++) {
+				const BlobStats &stats = *ranked[b].blob;
+				int count = stats.count ? stats.count : 1;
+				printf("Blob %d: %d pixels, key %f, at %f, %f, %f\n", (int)b + 1, stats.size, ranked[b].key,
+					stats.x / count, stats.y / count, stats.z / count);
+			}
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	printf("%llu frames in %.3f s, %.1f frames/sec\n", processed, elapsed.count(),
+		elapsed.count() > 0 ? processed / elapsed.count() : 0.0);
+	if (capture)
+		printf("%llu frames skipped while processing\n", capture->skipped());
+	if (processed > WARM_UP_FRAMES) {
+		unsigned long long arenas = arena_allocations() - warm_arenas;
+		printf("%llu heap allocations in the last %llu frames, %llu of them by the frame arenas\n",
+			heap_allocations - warm_allocations + arenas, processed - WARM_UP_FRAMES, arenas);
+	}
+	if (adaptive)
+		printf("Color model learned from %llu frames, %llu table cells rewritten\n", adaptive->updates(), adaptive->rewritten());
+	if (coarse > 1)
+		printf("%llu tiles labeled at full resolution, %llu frames scanned in full\n", coarse_locator.tiles(), coarse_locator.full_scans());
+	else if (roi >= 0)
+		printf("%llu frames searched in a window, %llu in full\n", tracker.window_scans(), tracker.full_scans());
+	return EXIT_SUCCESS;
+}
+catch (const std::exception & e)
+{
+	std::cerr << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+	// sequential hints the OS to read ahead
+	MappedFile(const char *filename, bool sequential = false) : _data(NULL), _size(0)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			throw std::runtime_error(std::string("Cannot open ") + filename);
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		_size = (uint64_t)size.QuadPart;
+		HANDLE mapping = _size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		CloseHandle(file);
+		if (!mapping)
+			throw std::runtime_error(std::string("Cannot map ") + filename);
+		_data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!_data)
+			throw std::runtime_error(std::string("Cannot map ") + filename);
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(std::string("Cannot open ") + filename);
+		struct stat st;
+		fstat(fd, &st);
+		_size = (uint64_t)st.st_size;
+		void *data = _size ? mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error(std::string("Cannot map ") + filename);
+		if (sequential)
+			madvise(data, _size, MADV_SEQUENTIAL);
+		_data = (const uint8_t *)data;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(_data);
+#else
+		munmap((void *)_data, _size);
+#endif
+	}
+
+	const uint8_t *data() const { return _data; }
+	uint64_t size() const { return _size; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const uint8_t *_data;
+	uint64_t _size;
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "mask_provider.hpp"
+
+// Pool of the large blocks stb_image allocates per decode (zlib output, image,
+// JPEG planes). Freed blocks are kept and handed out again, so a steady stream of
+// same-sized masks stops hitting the heap
+const size_t MASK_BUFFER_MIN = 64 * 1024; // smaller blocks go straight to malloc
+const size_t MASK_BUFFER_KEEP = 32;       // freed blocks kept for reuse
+
+struct MaskBufferPool {
+	std::mutex mutex;
+	std::vector<void *> free_blocks;
+};
+
+inline MaskBufferPool &mask_buffer_pool()
+{
+	static MaskBufferPool pool;
+	return pool;
+}
+
+// Every block starts with its capacity, padded to keep the data 16-byte aligned
+inline size_t &mask_buffer_capacity(void *block)
+{
+	return *(size_t *)block;
+}
+
+inline void *mask_buffer_alloc(size_t size)
+{
+	if (size >= MASK_BUFFER_MIN) {
+		MaskBufferPool &pool = mask_buffer_pool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		// Best fit that wastes at most half of the block
+		size_t best = pool.free_blocks.size();
+		for (size_t i = 0; i < pool.free_blocks.size(); i++) {
+			size_t capacity = mask_buffer_capacity(pool.free_blocks[i]);
+			if (capacity >= size && capacity / 2 <= size &&
+				(best == pool.free_blocks.size() || capacity < mask_buffer_capacity(pool.free_blocks[best])))
+				best = i;
+		}
+		if (best < pool.free_blocks.size()) {
+			void *block = pool.free_blocks[best];
+			pool.free_blocks[best] = pool.free_blocks.back();
+			pool.free_blocks.pop_back();
+			return (char *)block + 16;
+		}
+	}
+	void *block = malloc(size + 16);
+	if (!block)
+		return NULL;
+	mask_buffer_capacity(block) = size;
+	return (char *)block + 16;
+}
+
+inline void mask_buffer_free(void *p)
+{
+	if (!p)
+		return;
+	void *block = (char *)p - 16;
+	if (mask_buffer_capacity(block) >= MASK_BUFFER_MIN) {
+		MaskBufferPool &pool = mask_buffer_pool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if (pool.free_blocks.size() < MASK_BUFFER_KEEP) {
+			pool.free_blocks.push_back(block);
+			return;
+		}
+	}
+	free(block);
+}
+
+inline void *mask_buffer_realloc(void *p, size_t size)
+{
+	if (!p)
+		return mask_buffer_alloc(size);
+	size_t capacity = mask_buffer_capacity((char *)p - 16);
+	if (capacity >= size)
+		return p;
+	void *grown = mask_buffer_alloc(size);
+	if (!grown)
+		return NULL;
+	memcpy(grown, p, capacity);
+	mask_buffer_free(p);
+	return grown;
+}
+
+// Private copy of the bundled stb_image, PNG and JPEG only, allocating from the pool
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#define STBI_NO_STDIO
+#define STBI_NO_LINEAR
+#define STBI_MALLOC(size) mask_buffer_alloc(size)
+#define STBI_REALLOC(p, size) mask_buffer_realloc(p, size)
+#define STBI_FREE(p) mask_buffer_free(p)
+#include "stb_image.h"
+
+// Decodes a BMP, PNG or JPEG file held in memory. BMPs are wrapped without decoding
+inline std::shared_ptr<const MaskImage> decode_mask(std::vector<uint8_t> &bytes, const char *name)
+{
+	if (bytes.size() >= 2 && bytes[0] == 'B' && bytes[1] == 'M')
+		return std::make_shared<const MaskImage>(bytes, name);
+
+	int width, height, channels;
+	uint8_t *rgb = bytes.empty() ? NULL :
+		stbi_load_from_memory(&bytes[0], (int)bytes.size(), &width, &height, &channels, 3);
+	if (!rgb)
+		throw std::runtime_error(std::string("Cannot decode ") + name);
+	return std::make_shared<const MaskImage>(rgb, width, height, mask_buffer_free);
+}
+
+// Reads a whole mask file into bytes
+inline void read_mask_file(const char *filename, std::vector<uint8_t> &bytes)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		throw std::runtime_error(std::string("Cannot open ") + filename);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	bytes.resize(size > 0 ? size : 0);
+	size_t read = bytes.empty() ? 0 : fread(&bytes[0], 1, bytes.size(), f);
+	fclose(f);
+	bytes.resize(read);
+}
+
+// A segmentation mask and the capture timestamp of the color frame it was computed
+// from, in the depth stream's clock (milliseconds, as FrameView::timestamp)
+struct TimedMask {
+	double timestamp;
+	std::shared_ptr<const MaskImage> image;
+};
+
+typedef BoundedQueue<TimedMask> MaskQueue;
+
+// A mask waiting for a decoder: a file to load, or bytes already read
+struct EncodedMask {
+	double timestamp;
+	std::string name;
+	std::vector<uint8_t> bytes;
+};
+
+// Decodes masks on a few worker threads while the main loop localizes the previous
+// ones, and queues them in the order they were handed in, a slow decode holding back
+// the ones after it
+class MaskDecoder {
+public:
+	MaskDecoder(MaskQueue &out, int threads = 2, size_t backlog = 8)
+		: _pending(backlog, QUEUE_DROP_OLDEST), _out(out), _taken(0), _released(0)
+	{
+		for (int i = 0; i < (threads > 0 ? threads : 1); i++)
+			_threads.push_back(std::thread([this] { run(); }));
+	}
+
+	~MaskDecoder()
+	{
+		_pending.close();
+		for (size_t i = 0; i < _threads.size(); i++)
+			_threads[i].join();
+	}
+
+	// Queues a mask file. Uncompressed BMPs are mapped rather than read
+	void decode_file(double timestamp, const std::string &filename)
+	{
+		EncodedMask mask;
+		mask.timestamp = timestamp;
+		mask.name = filename;
+		_pending.push(std::move(mask));
+	}
+
+	// Queues file bytes, taking them over
+	void decode(double timestamp, std::vector<uint8_t> &bytes, const char *name)
+	{
+		EncodedMask mask;
+		mask.timestamp = timestamp;
+		mask.name = name;
+		mask.bytes.swap(bytes);
+		_pending.push(std::move(mask));
+	}
+
+	// Masks dropped because the decoders fell behind
+	unsigned long long dropped() const { return _pending.dropped(); }
+
+private:
+	MaskDecoder(const MaskDecoder &);
+	MaskDecoder &operator=(const MaskDecoder &);
+
+	// Takes the next mask and its place in the output. Tickets are given out in the
+	// order masks leave the backlog, so masks it evicted leave no gap
+	bool take(EncodedMask &mask, unsigned long long &ticket)
+	{
+		std::lock_guard<std::mutex> lock(_take_mutex);
+		if (!_pending.pop(mask))
+			return false;
+		ticket = _taken++;
+		return true;
+	}
+
+	// Queues the decoded masks that are next in line. A mask that failed to decode has
+	// no image and only lets the ones after it through
+	void release(unsigned long long ticket, const TimedMask &decoded)
+	{
+		std::lock_guard<std::mutex> lock(_release_mutex);
+		Decoded done = { ticket, decoded };
+		_done.push_back(done);
+		for (size_t i = 0; i < _done.size();) {
+			if (_done[i].ticket != _released) {
+				i++;
+				continue;
+			}
+			if (_done[i].mask.image)
+				_out.push(_done[i].mask);
+			_done[i] = _done.back();
+			_done.pop_back();
+			_released++;
+			i = 0;
+		}
+	}
+
+	void run()
+	{
+		EncodedMask mask;
+		unsigned long long ticket;
+		while (take(mask, ticket)) {
+			TimedMask decoded;
+			decoded.timestamp = mask.timestamp;
+			try {
+				const std::string &name = mask.name;
+				if (mask.bytes.empty() && name.size() > 4 && !name.compare(name.size() - 4, 4, ".bmp"))
+					decoded.image = std::make_shared<const MaskImage>(name.c_str());
+				else {
+					if (mask.bytes.empty())
+						read_mask_file(name.c_str(), mask.bytes);
+					decoded.image = decode_mask(mask.bytes, name.c_str());
+				}
+			}
+			catch (const std::exception & e) {
+				fprintf(stderr, "Skipping mask: %s\n", e.what());
+			}
+			release(ticket, decoded);
+			mask.bytes.clear();
+		}
+	}
+
+	struct Decoded {
+		unsigned long long ticket;
+		TimedMask mask;
+	};
+
+	BoundedQueue<EncodedMask> _pending;
+	MaskQueue &_out;
+	std::mutex _take_mutex, _release_mutex;
+	unsigned long long _taken, _released;
+	std::vector<Decoded> _done;    // decoded out of turn, at most one per worker
+	std::vector<std::thread> _threads;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "directory_watcher.hpp"
+#include "mapped_file.hpp"
+
+// A segmentation mask. Uncompressed 24-bit BMPs are read in place and stay BGR as
+// stored in the file, other formats are decoded to RGB by mask_decoder.hpp
+class MaskImage {
+public:
+	MaskImage(const char *filename) : _release(NULL)
+	{
+#ifdef _WIN32
+		// A mapped file cannot be replaced on Windows, which would block the segmentation
+		// process, so keep a private copy instead
+		FILE *f = fopen(filename, "rb");
+		if (!f)
+			throw std::runtime_error(std::string("Cannot open ") + filename);
+		fseek(f, 0, SEEK_END);
+		_copy.resize(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		size_t read = _copy.empty() ? 0 : fread(&_copy[0], 1, _copy.size(), f);
+		fclose(f);
+		_copy.resize(read);
+		parse(_copy.empty() ? NULL : &_copy[0], _copy.size(), filename);
+#else
+		_file.reset(new MappedFile(filename));
+		parse(_file->data(), _file->size(), filename);
+#endif
+	}
+
+	// Takes over a BMP file already read into memory
+	MaskImage(std::vector<uint8_t> &bytes, const char *name) : _release(NULL)
+	{
+		_copy.swap(bytes);
+		parse(_copy.empty() ? NULL : &_copy[0], _copy.size(), name);
+	}
+
+	// Takes over decoded top-down RGB pixels, handed back to release when done
+	MaskImage(uint8_t *rgb, int width, int height, void (*release)(void *))
+		: _release(release), _pixels(rgb), _width(width), _height(height),
+		_stride((size_t)width * 3), _bottom_up(false), _red(0) {}
+
+	~MaskImage()
+	{
+		if (_release)
+			_release((void *)_pixels);
+	}
+
+	int width() const { return _width; }
+	int height() const { return _height; }
+
+	// The 3 channels of pixel (x, y), with y = 0 the top row. Their order is given by
+	// red() and blue(), green is always 1
+	const uint8_t *pixel(int x, int y) const
+	{
+		int row = _bottom_up ? _height - 1 - y : y;
+		return _pixels + row * _stride + 3 * x;
+	}
+
+	int red() const { return _red; }
+	int blue() const { return 2 - _red; }
+
+private:
+	MaskImage(const MaskImage &);
+	MaskImage &operator=(const MaskImage &);
+
+	void parse(const uint8_t *data, uint64_t size, const char *name)
+	{
+		if (size < 54 || data[0] != 'B' || data[1] != 'M')
+			throw std::runtime_error(std::string(name) + " is not a BMP");
+
+		uint32_t offset;
+		int32_t width, height;
+		uint16_t bits;
+		uint32_t compression;
+		memcpy(&offset, data + 10, 4);
+		memcpy(&width, data + 18, 4);
+		memcpy(&height, data + 22, 4);
+		memcpy(&bits, data + 28, 2);
+		memcpy(&compression, data + 30, 4);
+		if (bits != 24 || compression != 0)
+			throw std::runtime_error(std::string(name) + " is not an uncompressed 24-bit BMP");
+
+		// Rows are bottom-up unless the height is negative, and padded to 4 bytes
+		_bottom_up = height > 0;
+		_width = width;
+		_height = height > 0 ? height : -height;
+		_stride = ((size_t)_width * 3 + 3) & ~(size_t)3;
+		if (_width <= 0 || offset + _stride * _height > size)
+			throw std::runtime_error(std::string(name) + " is truncated");
+		_pixels = data + offset;
+		_red = 2;
+	}
+
+	std::vector<uint8_t> _copy;
+#ifndef _WIN32
+	std::unique_ptr<MappedFile> _file;
+#endif
+	void (*_release)(void *);
+	const uint8_t *_pixels;
+	int _width, _height;
+	size_t _stride;
+	bool _bottom_up;
+	int _red;
+};
+
+// Keeps the latest version of a mask file loaded. A watcher thread reloads the file when
+// it changes, so current() only costs a lock and a reference count.
+//
+// Writers should replace the file (write elsewhere, then rename over it) rather than
+// rewrite it in place, which would truncate it under the readers' mapping.
+class MaskProvider {
+public:
+	MaskProvider(const char *filename) : _path(filename), _version(1), _stop(false)
+	{
+		// Watch the directory, so replacing the file by rename is seen too. It is watched
+		// before the first load, so a change made while loading is not missed
+		size_t slash = _path.find_last_of("/\\");
+		_name = slash == std::string::npos ? _path : _path.substr(slash + 1);
+		_watcher.reset(new DirectoryWatcher(slash == std::string::npos ? "." : _path.substr(0, slash)));
+		_current.reset(new MaskImage(filename));
+		_thread = std::thread([this] { watch(); });
+	}
+
+	~MaskProvider()
+	{
+		_stop = true;
+		_thread.join();
+	}
+
+	// The newest mask. It stays valid for as long as the caller holds on to the copy
+	std::shared_ptr<const MaskImage> current() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _current;
+	}
+
+	// Incremented every time the mask is reloaded
+	unsigned long long version() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _version;
+	}
+
+private:
+	MaskProvider(const MaskProvider &);
+	MaskProvider &operator=(const MaskProvider &);
+
+	void reload()
+	{
+		try {
+			std::shared_ptr<const MaskImage> mask(new MaskImage(_path.c_str()));
+			std::lock_guard<std::mutex> lock(_mutex);
+			_current = mask;
+			_version++;
+		}
+		catch (const std::exception & e) {
+			// Keep the previous mask, the next change will be picked up
+			fprintf(stderr, "Mask reload failed: %s\n", e.what());
+		}
+	}
+
+	void watch()
+	{
+		std::vector<std::string> names;
+		while (!_stop) {
+			names.clear();
+			_watcher->wait(200, names);
+			if (std::find(names.begin(), names.end(), _name) != names.end())
+				reload();
+		}
+	}
+
+	std::string _path, _name;
+	std::unique_ptr<DirectoryWatcher> _watcher;
+	std::shared_ptr<const MaskImage> _current;
+	unsigned long long _version;
+	mutable std::mutex _mutex;
+	std::atomic<bool> _stop;
+	std::thread _thread;
+};
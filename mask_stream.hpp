@@ -0,0 +1,230 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#endif
+
+#include "bounded_queue.hpp"
+#include "directory_watcher.hpp"
+#include "frame_source.hpp"
+#include "mask_decoder.hpp"
+#include "mask_provider.hpp"
+
+// Decodes every BMP, PNG or JPEG mask written or renamed into a directory. The file
+// name is the capture timestamp, e.g. 1529412345678.250.png
+class MaskDirectoryReader {
+public:
+	MaskDirectoryReader(const char *dir, MaskDecoder &decoder)
+		: _dir(dir), _decoder(decoder), _stop(false), _thread([this] { run(); }) {}
+
+	~MaskDirectoryReader()
+	{
+		_stop = true;
+		_thread.join();
+	}
+
+private:
+	MaskDirectoryReader(const MaskDirectoryReader &);
+	MaskDirectoryReader &operator=(const MaskDirectoryReader &);
+
+	void run()
+	{
+		DirectoryWatcher watcher(_dir);
+		std::vector<std::string> names;
+		while (!_stop) {
+			names.clear();
+			watcher.wait(200, names);
+			for (size_t i = 0; i < names.size(); i++) {
+				const std::string &name = names[i];
+				size_t dot = name.find_last_of('.');
+				std::string extension = dot == std::string::npos ? "" : name.substr(dot);
+				if (extension != ".bmp" && extension != ".png" && extension != ".jpg" && extension != ".jpeg")
+					continue;
+				char *end;
+				double timestamp = strtod(name.c_str(), &end);
+				if (end == name.c_str())
+					continue;
+				_decoder.decode_file(timestamp, _dir + "/" + name);
+			}
+		}
+	}
+
+	std::string _dir;
+	MaskDecoder &_decoder;
+	std::atomic<bool> _stop;
+	std::thread _thread;
+};
+
+// Decodes masks streamed through a pipe ("-" for stdin). Each record is the capture
+// timestamp as a little-endian double, the file size as a uint32 and the bytes of a
+// BMP, PNG or JPEG file. Stops at end of stream, and at a file too large for a width x
+// height mask, whose size is taken to be corrupt: the records after it cannot be found
+class MaskPipeReader {
+public:
+	MaskPipeReader(const char *path, MaskDecoder &decoder, int width, int height)
+		: _decoder(decoder), _max_size((size_t)width * height * 4 + MASK_FILE_HEADERS), _stop(false)
+	{
+		_file = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+		if (!_file)
+			throw std::runtime_error(std::string("Cannot open ") + path);
+		// readable() looks at the pipe itself, so nothing may sit in a stdio buffer
+		setvbuf(_file, NULL, _IONBF, 0);
+		_thread = std::thread([this] { run(); });
+	}
+
+	~MaskPipeReader()
+	{
+		_stop = true;
+		_thread.join();
+		if (_file != stdin)
+			fclose(_file);
+	}
+
+private:
+	MaskPipeReader(const MaskPipeReader &);
+	MaskPipeReader &operator=(const MaskPipeReader &);
+
+	// Waits for data without blocking in fread, so the reader can be stopped
+	bool readable()
+	{
+#ifdef _WIN32
+		HANDLE pipe = (HANDLE)_get_osfhandle(_fileno(_file));
+		DWORD available = 0;
+		if (!PeekNamedPipe(pipe, NULL, 0, NULL, &available, NULL))
+			return true; // not a pipe, or the writer is gone and fread reports it
+		if (!available)
+			Sleep(5);
+		return available > 0;
+#else
+		struct pollfd pfd = { fileno(_file), POLLIN, 0 };
+		return poll(&pfd, 1, 200) != 0;
+#endif
+	}
+
+	bool read_fully(void *data, size_t size)
+	{
+		uint8_t *p = (uint8_t *)data;
+		while (size) {
+			if (_stop)
+				return false;
+			if (!readable())
+				continue;
+			size_t n = fread(p, 1, size, _file);
+			if (!n)
+				return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	void run()
+	{
+		std::vector<uint8_t> bytes;
+		double timestamp;
+		uint32_t size;
+		while (read_fully(&timestamp, sizeof(timestamp)) && read_fully(&size, sizeof(size))) {
+			if (size > _max_size) {
+				fprintf(stderr, "Dropping the mask stream: a %u byte mask, at most %zu expected\n", size, _max_size);
+				break;
+			}
+			bytes.resize(size);
+			if (!read_fully(size ? &bytes[0] : NULL, size))
+				break;
+			_decoder.decode(timestamp, bytes, "piped mask");
+		}
+	}
+
+	// Room beyond 4 bytes a pixel for file headers, palettes and the overhead of
+	// compression that does not pay off
+	static const size_t MASK_FILE_HEADERS = 64 * 1024;
+
+	FILE *_file;
+	MaskDecoder &_decoder;
+	size_t _max_size;
+	std::atomic<bool> _stop;
+	std::thread _thread;
+};
+
+// A mask paired with the depth frame captured closest to it. depth.color is NULL
+struct SyncedMask {
+	TimedMask mask;
+	FrameView depth;
+	double skew; // depth minus mask timestamp, in milliseconds
+};
+
+// Keeps copies of the last few depth frames so masks, which arrive late, can be paired
+// with the depth captured at the same time rather than the newest one
+class MaskSynchronizer {
+public:
+	MaskSynchronizer(size_t frames, double max_skew)
+		: _slots(frames ? frames : 1), _next(0), _count(0), _max_skew(max_skew) {}
+
+	// Copies the depth plane of frame into the history
+	void push_depth(const FrameView &frame)
+	{
+		Slot &slot = _slots[_next];
+		slot.depth.assign(frame.depth, frame.depth + frame.width * frame.height);
+		slot.view = frame;
+		slot.view.depth = &slot.depth[0];
+		slot.view.color = NULL;
+		_next = (_next + 1) % _slots.size();
+		if (_count < _slots.size())
+			_count++;
+	}
+
+	// Pairs the oldest queued mask with its nearest depth frame. Masks without a depth
+	// frame within max_skew are dropped. Returns false when no mask can be paired yet.
+	// The depth view stays valid until the next push_depth()
+	bool pair(MaskQueue &masks, SyncedMask &out)
+	{
+		TimedMask mask;
+		while (_count) {
+			// A mask newer than every depth frame kept may still get a closer one
+			double newest = _slots[(_next + _slots.size() - 1) % _slots.size()].view.timestamp;
+			if (!masks.try_pop_if(mask, [newest](const TimedMask &m) { return m.timestamp <= newest; }))
+				return false;
+
+			const Slot *nearest = NULL;
+			for (size_t i = 0; i < _count; i++) {
+				const Slot &slot = _slots[(_next + _slots.size() - 1 - i) % _slots.size()];
+				if (!nearest || fabs(slot.view.timestamp - mask.timestamp) < fabs(nearest->view.timestamp - mask.timestamp))
+					nearest = &slot;
+			}
+			double skew = nearest->view.timestamp - mask.timestamp;
+			if (fabs(skew) > _max_skew) {
+				masks.count_dropped();
+				continue;
+			}
+			out.mask = mask;
+			out.depth = nearest->view;
+			out.skew = skew;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	struct Slot {
+		std::vector<uint16_t> depth;
+		FrameView view;
+	};
+
+	std::vector<Slot> _slots;
+	size_t _next, _count;
+	double _max_skew;
+};
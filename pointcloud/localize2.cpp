@@ -3,18 +3,19 @@
 
 #include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
 #include "example.hpp"          // Include short list of convenience functions for rendering
+#include "realsense_source.hpp" // Live depth + color frames
+#include "mask_provider.hpp"    // Segmentation mask, reloaded when the file changes
+#include "mask_stream.hpp"      // Timestamped masks from a segmentation process
+#include "localize.hpp"         // vertex_at
 
 #include <algorithm>            // std::min, std::max
 #include <iomanip>				// std::setprecision
 
 #include <iostream>
 #include <map>
-
-struct Data {
-	unsigned char* vertices;
-	int width;
-	int height;
-};
+#include <memory>
+#include <string>
+#include <vector>
 
 struct RGB {
 	int triple[3];
@@ -24,8 +25,9 @@ struct RGB {
 
 // Helper functions
 void register_glfw_callbacks(window& app, glfw_state& app_state);
-Data readBMP(char* filename);
-int **create2D(int row, int col);
+void average_classes(const MaskImage &data, const FrameView &depth, const Point3 *vertices,
+	const std::vector<RGB> &targets, std::vector<int> &counts, std::vector<double> &averages);
+void print_classes(const std::vector<std::string> &names, const std::vector<int> &counts, const std::vector<double> &averages);
 
 int main(int argc, char * argv[]) try
 {
@@ -43,36 +45,59 @@ int main(int argc, char * argv[]) try
 	// We want the points object to be persistent so we can display the last cloud when a frame drops
 	rs2::points points;
 
-	// Declare RealSense pipeline, encapsulating the actual device and sensors
-	rs2::pipeline pipe;
-
-	rs2::config cfg;
-	cfg.enable_stream(RS2_STREAM_DEPTH); // Enable default depth
-										 // For the color stream, set format to RGBA
-										 // To allow blending of the color frame on top of the depth frame
-	cfg.enable_stream(RS2_STREAM_COLOR, RS2_FORMAT_RGBA8);
-	// rs2::config cfg;
-	// cfg.enable_stream(RS2_STREAM_DEPTH, 640, 480, RS2_FORMAT_Z16, 30); // Enable default depth
-										 // For the color stream, set format to RGBA
-										 // To allow blending of the color frame on top of the depth frame
-	// cfg.enable_stream(RS2_STREAM_COLOR, 640, 480, RS2_FORMAT_RGB8, 30);
-	
+	// Stream 640x480 Z16 depth and RGB8 color from the camera
+	RealSenseSource source(640, 480);
+	FrameView frame;
+
 	int first = 1;
 
-	// Start streaming with default recommended configuration
-    pipe.start(cfg);
+	// localize [--masks <dir> | --mask-pipe <path>] [--queue <masks>] [--max-skew <ms>]
+	//          [--mask-size <w>x<h>]
+	// streams timestamped masks from a segmentation process, otherwise testOutput.bmp is used.
+	// Piped masks larger than --mask-size, the depth resolution by default, end the stream
+	const char *mask_dir = NULL, *mask_pipe = NULL;
+	size_t queue_size = 4;
+	double max_skew = 20.0;
+	int mask_width = 640, mask_height = 480;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--masks"))
+			mask_dir = argv[i + 1];
+		else if (!strcmp(argv[i], "--mask-pipe"))
+			mask_pipe = argv[i + 1];
+		else if (!strcmp(argv[i], "--queue"))
+			queue_size = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--max-skew"))
+			max_skew = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--mask-size"))
+			sscanf(argv[i + 1], "%dx%d", &mask_width, &mask_height);
+	}
+
+	// Masks queue up while waiting for their depth frame, the oldest are dropped when full
+	MaskQueue queue(queue_size, QUEUE_DROP_OLDEST);
+	// PNG and JPEG masks decode on two threads while this one localizes
+	MaskDecoder decoder(queue, 2);
+	// One second of depth history to pair late masks with
+	MaskSynchronizer sync(30, max_skew);
+	std::unique_ptr<MaskDirectoryReader> dir_reader;
+	std::unique_ptr<MaskPipeReader> pipe_reader;
+	std::unique_ptr<MaskProvider> masks;
+	if (mask_dir)
+		dir_reader.reset(new MaskDirectoryReader(mask_dir, decoder));
+	else if (mask_pipe)
+		pipe_reader.reset(new MaskPipeReader(mask_pipe, decoder, mask_width, mask_height));
+	else
+		// Load the segmentation mask once, it is only reloaded when the file changes
+		masks.reset(new MaskProvider("testOutput.bmp"));
 	
 	while (app) // Application still alive?
 	{
 		// Wait for the next set of frames from the camera
-		auto frames = pipe.wait_for_frames();
+		if (!source.next(frame))
+			break;
+		auto frames = source.frames();
 		
 		auto depth = frames.get_depth_frame();
 
-		auto depth_width = depth.get_width();
-
-		auto depth_height = depth.get_height();
-
 		// Generate the pointcloud and texture mappings
 		points = pc.calculate(depth);
 
@@ -86,51 +111,35 @@ int main(int argc, char * argv[]) try
 		classes["bike"] = { 0, 128, 0 }; // green
 		classes["cyclist"] = { 255,192,203 }; // pink
 
-		Data data = readBMP("testOutput.bmp");
-
-		auto tex_coords = points.get_texture_coordinates(); // and texture coordinates
-
-		double width_ratio = depth_width / (double) data.width;
-		double height_ratio = depth_height / (double) data.height;
-
-		double x_total = 0.0;
-		double y_total = 0.0;
-		double z_total = 0.0;
-		int total_vertices = 0;
-
-		// what we are trying to localize
-		RGB target = classes["cyclist"];
+		// what we are trying to localize: every class, in one pass over the mask
+		std::vector<std::string> names;
+		std::vector<RGB> targets;
+		for (std::map<std::string, RGB>::const_iterator it = classes.begin(); it != classes.end(); ++it) {
+			names.push_back(it->first);
+			targets.push_back(it->second);
+		}
+		std::vector<int> counts;
+		std::vector<double> averages;
 
-		// go through image
-		for (int x = 0; x < data.width; x++)
-		{
-			for (int y = 0; y < data.height; y++)
-			{
-				// if color of this pixel is same as target
-				if (data.vertices[3 * (x * data.width + y)] == target.triple[0] &&
-					data.vertices[3 * (x * data.width + y) + 1] == target.triple[1] &&
-					data.vertices[3 * (x * data.width + y) + 2] == target.triple[2])
-				{
-					// update totals
-					total_vertices += 1;
-					int depth_x = (int) (x * width_ratio);
-					int depth_y = (int) (y * height_ratio);
-					x_total += vertices[depth_x + depth_y * data.width].x;
-					y_total += vertices[depth_x + depth_y * data.width].y;
-					z_total += vertices[depth_x + depth_y * data.width].z;
-					color.get_data();
-				}
+		if (masks) {
+			average_classes(*masks->current(), frame, (const Point3 *)vertices, targets, counts, averages);
+			print_classes(names, counts, averages);
+		}
+		else {
+			// Localize every mask that arrived against the depth captured with it
+			sync.push_depth(frame);
+			SyncedMask synced;
+			while (sync.pair(queue, synced)) {
+				// Only the mask pixels are deprojected, from the depth kept for pairing
+				average_classes(*synced.mask.image, synced.depth, NULL, targets, counts, averages);
+				std::cout << "\nmask " << std::fixed << std::setprecision(3) << synced.mask.timestamp
+					<< " paired with depth " << synced.depth.timestamp
+					<< " (" << queue.dropped() + decoder.dropped() << " dropped)";
+				std::cout.unsetf(std::ios::floatfield);
+				print_classes(names, counts, averages);
 			}
 		}
 
-		double avg_x = x_total / total_vertices;
-		double avg_y = y_total / total_vertices;
-		double avg_z = z_total / total_vertices;
-
-		std::cout << std::setprecision(5) << "\nx average is: " << avg_x;
-		std::cout << std::setprecision(5) << "\ny average is: " << avg_y;
-		std::cout << std::setprecision(5) << "\nz average is: " << avg_z;
-
 		// Tell pointcloud object to map to this color frame
 		pc.map_to(color);
 
@@ -154,56 +163,69 @@ catch (const std::exception & e)
 	return EXIT_FAILURE;
 }
 
-// from https://stackoverflow.com/questions/9296059/read-pixel-value-in-bmp-file
-Data readBMP(char* filename)
+// Averages the vertices under the pixels of each target color of the mask, in a single
+// pass whatever the number of targets. counts (pixels with depth data) and averages (x, y,
+// z per target) are resized to match, a target without any is left at zero. Without
+// vertices, the pixels are deprojected from the depth frame as they are found
+void average_classes(const MaskImage &data, const FrameView &depth, const Point3 *vertices,
+	const std::vector<RGB> &targets, std::vector<int> &counts, std::vector<double> &averages)
 {
-	int i;
-	FILE* f = fopen(filename, "rb");
-	unsigned char info[54];
-	fread(info, sizeof(unsigned char), 54, f); // read the 54-byte header
-
-	int numBits = *(int*)&info[28];
-	if (numBits == 24) {
-		///throw "24 bit bmp not supported";
-	}
+	double width_ratio = depth.width / (double) data.width();
+	double height_ratio = depth.height / (double) data.height();
 
-	// extract image height and width from header
-	int width = *(int*)&info[18];
-	int height = *(int*)&info[22];
+	counts.assign(targets.size(), 0);
+	averages.assign(targets.size() * 3, 0.0);
 
-	int size = 3 * width * height;
-	unsigned char* vertices = new unsigned char[size]; // allocate 3 bytes per pixel
-	fread(vertices, sizeof(unsigned char), size, f); // read the rest of the data at once
-	fclose(f);
-
-	for (i = 0; i < size; i += 3)
+	// go through image, row by row in memory order
+	for (int y = 0; y < data.height(); y++)
 	{
-		// Convert (B, G, R) to (R, G, B)
-		unsigned char tmp = vertices[i];
-		vertices[i] = vertices[i + 2];
-		vertices[i + 2] = tmp;
+		int depth_y = (int) (y * height_ratio);
+		for (int x = 0; x < data.width(); x++)
+		{
+			// find the target this pixel is colored as, if any
+			const unsigned char *pixel = data.pixel(x, y);
+			for (size_t t = 0; t < targets.size(); t++)
+			{
+				if (pixel[data.red()] == targets[t].triple[0] &&
+					pixel[1] == targets[t].triple[1] &&
+					pixel[data.blue()] == targets[t].triple[2])
+				{
+					// update totals, skipping pixels without depth data: they deproject to
+					// the origin and would pull the average toward the camera
+					int depth_x = (int) (x * width_ratio);
+					Point3 vertex = vertex_at(depth, vertices, depth_x, depth_y);
+					if (vertex.z == 0)
+						break;
+					counts[t] += 1;
+					averages[3 * t] += vertex.x;
+					averages[3 * t + 1] += vertex.y;
+					averages[3 * t + 2] += vertex.z;
+					break;
+				}
+			}
+		}
 	}
 
-	// store relevant data in struct
-	Data data;
-	data.vertices = vertices;
-	data.width = width;
-	data.height = height;
-
-	return data;
+	for (size_t t = 0; t < targets.size(); t++)
+		if (counts[t])
+			for (int i = 0; i < 3; i++)
+				averages[3 * t + i] /= counts[t];
 }
 
-int **create2D(int row, int col) {
-	// create the array
-	int **arr = new int*[row];
-	for (int i = 0; i < row; i++) {
-		arr[i] = new int[col];
-		// fill array
-		for (int j = 0; j < col; j++) {
-			arr[i][j] = 1;
+void print_classes(const std::vector<std::string> &names, const std::vector<int> &counts, const std::vector<double> &averages)
+{
+	for (size_t t = 0; t < names.size(); t++)
+	{
+		if (!counts[t])
+		{
+			std::cout << "\n" << names[t] << " not found";
+			continue;
 		}
+		std::cout << "\n" << names[t] << " (" << counts[t] << " pixels)";
+		std::cout << std::setprecision(5) << "\nx average is: " << averages[3 * t];
+		std::cout << std::setprecision(5) << "\ny average is: " << averages[3 * t + 1];
+		std::cout << std::setprecision(5) << "\nz average is: " << averages[3 * t + 2];
 	}
-	return arr;
 }
 
 int equalsRGB(RGB r1, RGB r2) {
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include "frame_source.hpp"
+
+// Live frames from the first connected RealSense camera, Z16 depth + RGB8 color
+class RealSenseSource : public FrameSource {
+public:
+	RealSenseSource(int width, int height, int fps = 30)
+	{
+		rs2::config cfg;
+		cfg.enable_stream(RS2_STREAM_DEPTH, width, height, RS2_FORMAT_Z16, fps);
+		cfg.enable_stream(RS2_STREAM_COLOR, width, height, RS2_FORMAT_RGB8, fps);
+		auto profile = _pipe.start(cfg);
+
+		auto stream = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+		rs2_intrinsics intrin = stream.get_intrinsics();
+		_intrin.width = intrin.width;
+		_intrin.height = intrin.height;
+		_intrin.ppx = intrin.ppx;
+		_intrin.ppy = intrin.ppy;
+		_intrin.fx = intrin.fx;
+		_intrin.fy = intrin.fy;
+		_intrin.inverse_brown_conrady = intrin.model == RS2_DISTORTION_INVERSE_BROWN_CONRADY;
+		for (int i = 0; i < 5; i++)
+			_intrin.coeffs[i] = intrin.coeffs[i];
+		_intrin.depth_scale = profile.get_device().first<rs2::depth_sensor>().get_depth_scale();
+	}
+
+	bool next(FrameView &frame) override
+	{
+		_frames = _pipe.wait_for_frames();
+
+		auto depth = _frames.get_depth_frame();
+		auto color = _frames.get_color_frame();
+
+		frame.depth = (const uint16_t *)depth.get_data();
+		frame.color = (const uint8_t *)color.get_data();
+		frame.width = depth.get_width();
+		frame.height = depth.get_height();
+		frame.intrin = _intrin;
+		frame.timestamp = depth.get_timestamp();
+		frame.number = depth.get_frame_number();
+		return true;
+	}
+
+	// The frameset behind the last view, for rendering and pointcloud calculation
+	const rs2::frameset &frames() const { return _frames; }
+
+private:
+	rs2::pipeline _pipe;
+	rs2::frameset _frames;
+	Intrinsics _intrin;
+};
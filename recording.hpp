@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "mapped_file.hpp"
+
+// Recorded session layout. Every block starts on a page boundary so each plane can be
+// handed out straight from the mapping:
+//
+//   page 0       RecordingHeader
+//   per frame    Z16 depth plane, RGB8 color plane (each padded to RECORDING_PAGE)
+//   at index     RecordingIndexEntry[frame_count]
+const uint32_t RECORDING_MAGIC = 0x434C5352; // "RSLC"
+const uint32_t RECORDING_OPEN = 0x3F4C5352;  // "RSL?", until close() writes the index
+const uint32_t RECORDING_VERSION = 1;
+const uint64_t RECORDING_PAGE = 4096;
+const int RECORDING_MAX_SIDE = 16384;  // pixels, anything wider or taller is a corrupt header
+
+struct RecordingHeader {
+	uint32_t magic;
+	uint32_t version;
+	Intrinsics intrin;
+	uint64_t frame_count;
+	uint64_t index_offset;
+	uint64_t depth_plane;   // padded bytes of a depth plane
+	uint64_t color_plane;   // padded bytes of a color plane
+};
+
+struct RecordingIndexEntry {
+	double timestamp;
+	uint64_t number;
+	uint64_t depth_offset;
+	uint64_t color_offset;
+};
+
+inline uint64_t recording_pad(uint64_t size)
+{
+	return (size + RECORDING_PAGE - 1) / RECORDING_PAGE * RECORDING_PAGE;
+}
+
+// Appends frames to a new recording. The index and header are written by close()
+class RecordingWriter {
+public:
+	RecordingWriter(const char *filename, const Intrinsics &intrin) : _offset(0)
+	{
+		_file = fopen(filename, "wb");
+		if (!_file)
+			throw std::runtime_error(std::string("Cannot create recording ") + filename);
+
+		memset(&_header, 0, sizeof(_header));
+		_header.magic = RECORDING_OPEN;
+		_header.version = RECORDING_VERSION;
+		_header.intrin = intrin;
+		_header.depth_plane = recording_pad((uint64_t)intrin.width * intrin.height * 2);
+		_header.color_plane = recording_pad((uint64_t)intrin.width * intrin.height * 3);
+
+		// Reserve the header page, it is rewritten on close. Until then it does not pass for
+		// a recording, so a writer that never closes leaves a file that fails to open
+		write_block(&_header, sizeof(_header));
+	}
+
+	~RecordingWriter()
+	{
+		close();
+	}
+
+	void write(const FrameView &frame)
+	{
+		if (frame.width != _header.intrin.width || frame.height != _header.intrin.height)
+			throw std::runtime_error("Frame size does not match the recording");
+
+		RecordingIndexEntry entry;
+		entry.timestamp = frame.timestamp;
+		entry.number = frame.number;
+		entry.depth_offset = write_block(frame.depth, (size_t)frame.width * frame.height * 2);
+		entry.color_offset = write_block(frame.color, (size_t)frame.width * frame.height * 3);
+		_index.push_back(entry);
+	}
+
+	void close()
+	{
+		if (!_file)
+			return;
+
+		_header.magic = RECORDING_MAGIC;
+		_header.frame_count = _index.size();
+		_header.index_offset = _offset;
+		if (!_index.empty())
+			fwrite(&_index[0], sizeof(RecordingIndexEntry), _index.size(), _file);
+		// The index is on disk before the header says the recording is whole
+		fflush(_file);
+		fseek(_file, 0, SEEK_SET);
+		fwrite(&_header, sizeof(_header), 1, _file);
+		fclose(_file);
+		_file = NULL;
+	}
+
+private:
+	RecordingWriter(const RecordingWriter &);
+	RecordingWriter &operator=(const RecordingWriter &);
+
+	// Writes data padded to the next page, returns its offset
+	uint64_t write_block(const void *data, size_t size)
+	{
+		static const char zeros[RECORDING_PAGE] = { 0 };
+		uint64_t offset = _offset;
+		uint64_t padded = recording_pad(size);
+		if (fwrite(data, 1, size, _file) != size)
+			throw std::runtime_error("Failed writing recording");
+		for (uint64_t left = padded - size; left; ) {
+			size_t chunk = (size_t)std::min<uint64_t>(left, RECORDING_PAGE);
+			fwrite(zeros, 1, chunk, _file);
+			left -= chunk;
+		}
+		_offset += padded;
+		return offset;
+	}
+
+	FILE *_file;
+	RecordingHeader _header;
+	std::vector<RecordingIndexEntry> _index;
+	uint64_t _offset;
+};
+
+// Passes the frames of another source through, writing each one to a recording on its
+// way. Put under a CaptureThread, frames are recorded on the capture thread before they
+// are handed over, so the recording holds every frame, those processing skipped too
+class RecordingSource : public FrameSource {
+public:
+	RecordingSource(FrameSource &source, const char *filename) : _source(source), _filename(filename) {}
+
+	bool next(FrameView &frame) override
+	{
+		if (!_source.next(frame))
+			return false;
+		if (!_writer)
+			_writer.reset(new RecordingWriter(_filename.c_str(), frame.intrin));
+		_writer->write(frame);
+		return true;
+	}
+
+private:
+	FrameSource &_source;
+	std::string _filename;
+	std::unique_ptr<RecordingWriter> _writer;  // created on the first frame, which has the intrinsics
+};
+
+// Read-only memory mapping of a recording. Frames are views into the mapping, nothing
+// is copied
+class Recording {
+public:
+	Recording(const char *filename) : _file(filename, true)
+	{
+		const uint8_t *data = _file.data();
+		uint64_t size = _file.size();
+		if (size < sizeof(RecordingHeader))
+			fail(filename, "is truncated");
+		memcpy(&_header, data, sizeof(_header));
+		if (_header.magic == RECORDING_OPEN)
+			fail(filename, "has no index, it was not closed");
+		if (_header.magic != RECORDING_MAGIC || _header.version != RECORDING_VERSION)
+			fail(filename, "is not a recording");
+		if (!fits(_header.index_offset, _header.frame_count, sizeof(RecordingIndexEntry), size))
+			fail(filename, "is truncated");
+		_index = (const RecordingIndexEntry *)(data + _header.index_offset);
+
+		// Every frame is checked once here, so frame() can trust the index
+		const Intrinsics &intrin = _header.intrin;
+		if (intrin.width <= 0 || intrin.height <= 0 || intrin.width > RECORDING_MAX_SIDE || intrin.height > RECORDING_MAX_SIDE)
+			fail(filename, "has a corrupt header");
+		uint64_t pixels = (uint64_t)intrin.width * intrin.height;
+		for (uint64_t i = 0; i < _header.frame_count; i++) {
+			if (!fits(_index[i].depth_offset, pixels, 2, size) || !fits(_index[i].color_offset, pixels, 3, size))
+				fail(filename, "has frames past its end");
+		}
+	}
+
+	const Intrinsics &intrinsics() const { return _header.intrin; }
+	uint64_t size() const { return _header.frame_count; }
+
+	// Fills frame with the i-th recorded frame
+	void frame(uint64_t i, FrameView &frame) const
+	{
+		const RecordingIndexEntry &entry = _index[i];
+		frame.depth = (const uint16_t *)(_file.data() + entry.depth_offset);
+		frame.color = (const uint8_t *)(_file.data() + entry.color_offset);
+		frame.width = _header.intrin.width;
+		frame.height = _header.intrin.height;
+		frame.intrin = _header.intrin;
+		frame.timestamp = entry.timestamp;
+		frame.number = entry.number;
+	}
+
+	// Position of the first frame whose camera frame number is at least number
+	uint64_t find(uint64_t number) const
+	{
+		const RecordingIndexEntry *end = _index + _header.frame_count;
+		const RecordingIndexEntry *it = std::lower_bound(_index, end, number,
+			[](const RecordingIndexEntry &entry, uint64_t n) { return entry.number < n; });
+		return it - _index;
+	}
+
+private:
+	Recording(const Recording &);
+	Recording &operator=(const Recording &);
+
+	// Whether count items of item bytes from offset, on a page boundary, lie within size.
+	// Divides rather than multiplies, so corrupt values cannot overflow
+	static bool fits(uint64_t offset, uint64_t count, uint64_t item, uint64_t size)
+	{
+		return offset % RECORDING_PAGE == 0 && offset <= size && count <= (size - offset) / item;
+	}
+
+	static void fail(const char *filename, const char *what)
+	{
+		throw std::runtime_error(std::string("Recording ") + filename + " " + what);
+	}
+
+	MappedFile _file;
+	RecordingHeader _header;
+	const RecordingIndexEntry *_index;
+};
+
+// Plays back a recording at whatever rate the consumer reads it
+class ReplaySource : public FrameSource {
+public:
+	ReplaySource(const char *filename) : _recording(filename), _position(0) {}
+
+	bool next(FrameView &frame) override
+	{
+		if (_position >= _recording.size())
+			return false;
+		_recording.frame(_position++, frame);
+		return true;
+	}
+
+	// Continue playback from the i-th recorded frame
+	void seek(uint64_t i) { _position = i; }
+
+	// Continue playback from the camera frame number, or the next one recorded after it
+	void seek_number(uint64_t number) { _position = _recording.find(number); }
+
+	const Recording &recording() const { return _recording; }
+
+private:
+	Recording _recording;
+	uint64_t _position;
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_arena.hpp"
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// Labels a frame on several cores. The frame is cut into horizontal strips, one per
+// thread, and each strip is masked and labeled by its own BlobScanner in SCAN_RUNS mode.
+// Blobs cut by a strip border are then joined by matching the runs on either side of
+// it, every border on its own thread, through a lock-free union-find over the blobs of
+// all strips: a root is linked under another with a compare-and-swap, retried when a
+// concurrent link changed it. Blobs are numbered strip by strip, so the lowest number of
+// a set is its first pixel and the result comes out as the serial scanner's: the same
+// blobs in the same order, with the same largest one. The threads are started once and
+// wait between frames. No mask is kept
+class StripScanner {
+public:
+	// threads of 0 uses every core
+	StripScanner(int threads = 0) : _strips(threads > 0 ? threads : hardware_threads()), _used(0), _parent(NULL), _generation(0),
+		_pending(0), _stop(false), _frame(NULL), _vertices(NULL), _segmentation(NULL)
+	{
+		for (size_t t = 1; t < _strips.size(); t++)
+			_workers.push_back(std::thread([this, t] { run(t); }));
+	}
+
+	~StripScanner()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_start.notify_all();
+		for (size_t t = 0; t < _workers.size(); t++)
+			_workers[t].join();
+	}
+
+	int threads() const { return (int)_strips.size(); }
+	// Heap blocks taken by the per-frame union-find
+	unsigned long long allocations() const { return _arena.allocations(); }
+
+	// Blobs of the last scan, in the order of their first pixel
+	const std::vector<BlobStats> &blobs() const { return _blobs; }
+
+	void scan(const FrameView &frame, const Point3 *vertices, const Segmentation *segmentation = NULL)
+	{
+		_frame = &frame;
+		_vertices = vertices;
+		_segmentation = segmentation;
+		_arena.reset();
+		_used = frame.height < (int)_strips.size() ? frame.height : (int)_strips.size();
+		dispatch(LABEL_STRIPS);
+
+		// Blobs of strip s are numbered from _strips[s].offset on
+		uint32_t total = 0;
+		for (int s = 0; s < _used; s++) {
+			_strips[s].offset = total;
+			total += (uint32_t)_strips[s].scanner.blobs().size();
+		}
+		_parent = _arena.allocate<std::atomic<uint32_t> >(total);
+		for (uint32_t i = 0; i < total; i++)
+			new (&_parent[i]) std::atomic<uint32_t>(i);
+		dispatch(JOIN_BORDERS);
+
+		// Roots come before the rest of their set, so each set is summed into its root
+		_blobs.clear();
+		uint32_t *index = _arena.allocate<uint32_t>(total);
+		for (int s = 0; s < _used; s++) {
+			const std::vector<BlobStats> &blobs = _strips[s].scanner.blobs();
+			for (size_t b = 0; b < blobs.size(); b++) {
+				uint32_t i = _strips[s].offset + (uint32_t)b, root = find(i);
+				if (root == i) {
+					index[i] = (uint32_t)_blobs.size();
+					_blobs.push_back(blobs[b]);
+				}
+				else
+					add_stats(_blobs[index[root]], blobs[b]);
+			}
+		}
+
+		// The target moves from strip to strip, so every strip gets room for the runs and
+		// labels of the whole frame rather than growing when the target reaches it
+		size_t runs = 0;
+		uint32_t labels = 0;
+		for (int s = 0; s < _used; s++) {
+			runs += _strips[s].scanner.runs().size();
+			labels += _strips[s].scanner.labels();
+		}
+		for (int s = 0; s < _used; s++)
+			_strips[s].scanner.reserve(runs, labels);
+	}
+
+	// Averages the vertices of the largest blob into result, like localize_frame. Returns
+	// that blob, NULL when there is none
+	const BlobStats *localize(const FrameView &frame, const Point3 *vertices, Localization &result,
+		const Segmentation *segmentation = NULL)
+	{
+		scan(frame, vertices, segmentation);
+		const BlobStats *largest = largest_blob(_blobs);
+		result.blobs = (int)_blobs.size();
+		fill_result(largest, result);
+		return largest;
+	}
+
+private:
+	typedef BlobScanner::Run Run;
+
+	enum Phase {
+		LABEL_STRIPS,
+		JOIN_BORDERS
+	};
+
+	struct Strip {
+		Strip() : scanner(SCAN_RUNS), offset(0) {}
+		BlobScanner scanner;
+		int top, bottom;
+		std::vector<Run> first, last;  // runs of the strip's first and last rows, labeled by blob
+		uint32_t offset;
+	};
+
+	static int hardware_threads()
+	{
+		unsigned n = std::thread::hardware_concurrency();
+		return n ? (int)n : 1;
+	}
+
+	// Runs phase on every strip, the calling thread taking the first
+	void dispatch(Phase phase)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_phase = phase;
+			_pending = (int)_workers.size();
+			_generation++;
+		}
+		_start.notify_all();
+		work(0, phase);
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this] { return _pending == 0; });
+	}
+
+	void run(size_t t)
+	{
+		unsigned long long seen = 0;
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;) {
+			_start.wait(lock, [this, seen] { return _stop || _generation != seen; });
+			if (_stop)
+				return;
+			seen = _generation;
+			Phase phase = _phase;
+			lock.unlock();
+			work(t, phase);
+			lock.lock();
+			if (--_pending == 0)
+				_done.notify_one();
+		}
+	}
+
+	void work(size_t t, Phase phase)
+	{
+		if ((int)t >= _used)
+			return;
+		Strip &strip = _strips[t];
+		if (phase == LABEL_STRIPS) {
+			const FrameView &frame = *_frame;
+			strip.top = (int)((long long)frame.height * t / _used);
+			strip.bottom = (int)((long long)frame.height * (t + 1) / _used) - 1;
+			Window window = { 0, strip.top, frame.width - 1, strip.bottom };
+			strip.scanner.scan(frame, _vertices, _segmentation, &window);
+			// A row holds at most one run every other pixel
+			strip.first.reserve(frame.width / 2 + 1);
+			strip.last.reserve(frame.width / 2 + 1);
+			label_row(strip.scanner, strip.top, strip.first);
+			label_row(strip.scanner, strip.bottom, strip.last);
+		}
+		else if (t > 0)
+			join(_strips[t - 1], strip);
+	}
+
+	// Copies the runs of row y, labeled by the index of their blob in the strip
+	static void label_row(BlobScanner &scanner, int y, std::vector<Run> &runs)
+	{
+		runs.clear();
+		for (size_t r = scanner.row_begin(y); r < scanner.row_end(y); r++) {
+			Run run = scanner.runs()[r];
+			run.label = (uint32_t)scanner.blob_of(run);
+			runs.push_back(run);
+		}
+	}
+
+	// Unites the blobs of the runs that overlap across the border between two strips
+	void join(const Strip &above, const Strip &below)
+	{
+		size_t a = 0;
+		for (size_t b = 0; b < below.first.size(); b++) {
+			const Run &run = below.first[b];
+			while (a < above.last.size() && above.last[a].right < run.left)
+				a++;
+			for (size_t i = a; i < above.last.size() && above.last[i].left <= run.right; i++)
+				unite(above.offset + above.last[i].label, below.offset + run.label);
+		}
+	}
+
+	uint32_t find(uint32_t i) const
+	{
+		for (uint32_t parent; (parent = _parent[i].load(std::memory_order_acquire)) != i; )
+			i = parent;
+		return i;
+	}
+
+	// Links the higher root under the lower one. Only roots are ever relinked, and a
+	// root's parent only changes through this exchange, so a failed one means the root
+	// was just linked elsewhere and the roots are looked up again
+	void unite(uint32_t a, uint32_t b)
+	{
+		for (;;) {
+			a = find(a);
+			b = find(b);
+			if (a == b)
+				return;
+			if (b < a) {
+				uint32_t t = a;
+				a = b;
+				b = t;
+			}
+			uint32_t expected = b;
+			if (_parent[b].compare_exchange_weak(expected, a, std::memory_order_acq_rel))
+				return;
+		}
+	}
+
+	std::vector<Strip> _strips;
+	int _used;  // strips of the current frame, fewer than threads for very short frames
+	std::vector<std::thread> _workers;
+	FrameArena _arena;                // union-find of the frame, dropped with it
+	std::atomic<uint32_t> *_parent;
+	std::vector<BlobStats> _blobs;
+
+	std::mutex _mutex;
+	std::condition_variable _start, _done;
+	unsigned long long _generation;
+	int _pending;
+	bool _stop;
+	Phase _phase;
+	const FrameView *_frame;
+	const Point3 *_vertices;
+	const Segmentation *_segmentation;
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "localize.hpp"
+
+// What the scene generator puts in front of the camera
+struct SceneConfig {
+	int width, height;
+	int targets;          // target-colored discs, near TARGET_RED/GREEN/BLUE
+	int distractors;      // small target-colored discs far away, and off-color discs
+	float color_noise;    // standard deviation of per-channel color noise
+	float depth_noise;    // standard deviation of depth noise, in meters
+	float holes;          // fraction of pixels without depth data
+	unsigned seed;
+};
+
+inline SceneConfig default_scene(int width, int height)
+{
+	SceneConfig config;
+	config.width = width;
+	config.height = height;
+	config.targets = 1;
+	config.distractors = 0;
+	config.color_noise = 0;
+	config.depth_noise = 0;
+	config.holes = 0;
+	config.seed = 1;
+	return config;
+}
+
+// A fronto-parallel disc, and for targets the ground truth the localizer should find
+struct SceneObject {
+	float x, y, z;   // center, in meters in the depth camera frame
+	float radius;    // in meters
+	uint8_t r, g, b;
+	bool target;
+	int pixels;      // visible pixels in the rendered frame
+};
+
+// Renders depth+color frames of moving discs over a wall with known 3D positions.
+// Frame n is a pure function of the config and n, so scenes can be regenerated
+// on any machine
+class SceneGenerator {
+public:
+	SceneGenerator(const SceneConfig &config)
+		: _config(config), _intrin(default_intrinsics(config.width, config.height))
+	{
+		std::mt19937 rng(config.seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		int count = config.targets + config.distractors;
+		for (int i = 0; i < count; i++) {
+			Motion m;
+			bool target = i < config.targets;
+			bool decoy = !target && (i - config.targets) % 2 == 0; // target-colored distractor
+			m.z = target ? 0.6f + 1.4f * unit(rng) : 2.5f + 2.0f * unit(rng);
+			m.radius = target ? 0.04f + 0.04f * unit(rng) : (decoy ? 0.02f : 0.1f);
+			// Keep the whole path inside the view
+			float half_w = m.z * _intrin.ppx / _intrin.fx - m.radius;
+			float half_h = m.z * _intrin.ppy / _intrin.fy - m.radius;
+			m.amp_x = half_w * 0.3f * unit(rng);
+			m.amp_y = half_h * 0.3f * unit(rng);
+			m.x = (2 * unit(rng) - 1) * (half_w - m.amp_x);
+			m.y = (2 * unit(rng) - 1) * (half_h - m.amp_y);
+			m.speed = 0.02f + 0.05f * unit(rng);
+			m.phase = 6.2831853f * unit(rng);
+			if (target || decoy) {
+				// Stay well inside the TARGET_DIST sphere
+				m.r = (uint8_t)(TARGET_RED - 20 + (int)(40 * unit(rng)));
+				m.g = (uint8_t)(TARGET_GREEN + (int)(20 * unit(rng)));
+				m.b = (uint8_t)(TARGET_BLUE + (int)(20 * unit(rng)));
+			}
+			else {
+				m.r = 0x20;
+				m.g = (uint8_t)(0x60 + (int)(0x80 * unit(rng)));
+				m.b = (uint8_t)(0x60 + (int)(0x80 * unit(rng)));
+			}
+			m.target = target;
+			_motions.push_back(m);
+		}
+	}
+
+	const Intrinsics &intrinsics() const { return _intrin; }
+
+	// Renders frame n into depth (width * height) and color (width * height * 3), and
+	// returns every object of the scene with its visible pixel count
+	void render(unsigned long long n, uint16_t *depth, uint8_t *color, std::vector<SceneObject> &objects) const
+	{
+		int width = _config.width, height = _config.height;
+		std::mt19937 rng(_config.seed * 7919u + (unsigned)n);
+		std::normal_distribution<float> color_noise(0.0f, _config.color_noise > 0 ? _config.color_noise : 1.0f);
+		std::normal_distribution<float> depth_noise(0.0f, _config.depth_noise > 0 ? _config.depth_noise : 1.0f);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		objects.clear();
+		for (size_t i = 0; i < _motions.size(); i++) {
+			const Motion &m = _motions[i];
+			SceneObject o;
+			o.x = m.x + m.amp_x * cosf(m.speed * n + m.phase);
+			o.y = m.y + m.amp_y * sinf(m.speed * n + m.phase);
+			o.z = m.z;
+			o.radius = m.radius;
+			o.r = m.r;
+			o.g = m.g;
+			o.b = m.b;
+			o.target = m.target;
+			o.pixels = 0;
+			objects.push_back(o);
+		}
+
+		// Wall 3m away, then the discs back to front
+		float wall = 3.0f;
+		for (int i = 0; i < width * height; i++) {
+			depth[i] = (uint16_t)(wall / _intrin.depth_scale);
+			color[3 * i] = color[3 * i + 1] = color[3 * i + 2] = 0x80;
+		}
+		std::vector<int> &order = _order, &owner = _owner;
+		order.resize(objects.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = (int)i;
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return objects[a].z > objects[b].z; });
+		owner.assign(width * height, -1);
+		for (size_t k = 0; k < order.size(); k++) {
+			const SceneObject &o = objects[order[k]];
+			float cx = _intrin.ppx + o.x / o.z * _intrin.fx;
+			float cy = _intrin.ppy + o.y / o.z * _intrin.fy;
+			float rx = o.radius / o.z * _intrin.fx;
+			float ry = o.radius / o.z * _intrin.fy;
+			int x0 = std::max(0, (int)(cx - rx)), x1 = std::min(width - 1, (int)(cx + rx) + 1);
+			int y0 = std::max(0, (int)(cy - ry)), y1 = std::min(height - 1, (int)(cy + ry) + 1);
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					float dx = (x - cx) / rx, dy = (y - cy) / ry;
+					if (dx * dx + dy * dy >= 1.0f)
+						continue;
+					int i = x + y * width;
+					depth[i] = (uint16_t)(o.z / _intrin.depth_scale + 0.5f);
+					color[3 * i] = o.r;
+					color[3 * i + 1] = o.g;
+					color[3 * i + 2] = o.b;
+					owner[i] = order[k];
+				}
+			}
+		}
+		for (int i = 0; i < width * height; i++) {
+			if (owner[i] >= 0)
+				objects[owner[i]].pixels++;
+		}
+
+		// Sensor imperfections
+		if (_config.color_noise > 0 || _config.depth_noise > 0 || _config.holes > 0) {
+			for (int i = 0; i < width * height; i++) {
+				if (_config.color_noise > 0) {
+					for (int c = 0; c < 3; c++) {
+						int v = color[3 * i + c] + (int)lrintf(color_noise(rng));
+						color[3 * i + c] = (uint8_t)std::min(255, std::max(0, v));
+					}
+				}
+				if (_config.depth_noise > 0) {
+					int v = depth[i] + (int)lrintf(depth_noise(rng) / _intrin.depth_scale);
+					depth[i] = (uint16_t)std::min(65535, std::max(1, v));
+				}
+				if (_config.holes > 0 && unit(rng) < _config.holes)
+					depth[i] = 0;
+			}
+		}
+	}
+
+private:
+	struct Motion {
+		float x, y, z, radius;
+		float amp_x, amp_y, speed, phase;
+		uint8_t r, g, b;
+		bool target;
+	};
+
+	SceneConfig _config;
+	Intrinsics _intrin;
+	std::vector<Motion> _motions;
+	mutable std::vector<int> _order, _owner;  // scratch of render, kept between frames
+};
+
+// The target the localizer is expected to find: the one covering the most pixels
+inline const SceneObject *largest_target(const std::vector<SceneObject> &objects)
+{
+	const SceneObject *largest = NULL;
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (objects[i].target && (!largest || objects[i].pixels > largest->pixels))
+			largest = &objects[i];
+	}
+	return largest;
+}
+
+// Frames of a generated scene, with the ground truth of the last one
+class SyntheticSource : public FrameSource {
+public:
+	SyntheticSource(int width, int height, unsigned long long frames)
+		: _scene(default_scene(width, height)), _frames(frames), _number(0),
+		_depth(width * height), _color(width * height * 3) {}
+
+	SyntheticSource(const SceneConfig &config, unsigned long long frames)
+		: _scene(config), _frames(frames), _number(0),
+		_depth(config.width * config.height), _color(config.width * config.height * 3) {}
+
+	bool next(FrameView &frame) override
+	{
+		if (_frames && _number >= _frames)
+			return false;
+
+		_scene.render(_number, &_depth[0], &_color[0], _objects);
+
+		frame.depth = &_depth[0];
+		frame.color = &_color[0];
+		frame.intrin = _scene.intrinsics();
+		frame.width = frame.intrin.width;
+		frame.height = frame.intrin.height;
+		frame.timestamp = _number * (1000.0 / 30);
+		frame.number = _number++;
+		return true;
+	}
+
+	// Objects of the last frame returned by next()
+	const std::vector<SceneObject> &objects() const { return _objects; }
+
+private:
+	SceneGenerator _scene;
+	unsigned long long _frames; // 0 runs forever
+	unsigned long long _number;
+	std::vector<uint16_t> _depth;
+	std::vector<uint8_t> _color;
+	std::vector<SceneObject> _objects;
+};